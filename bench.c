@@ -16,11 +16,16 @@
    More information about the BLAKE2 hash function can be found at
    https://blake2.net.
 */
+#define _POSIX_C_SOURCE 200809L
+
 #include "blabla.h"
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 
 static int bench_cmp (const void *x, const void *y)
@@ -51,7 +56,14 @@ static unsigned long long cpucycles (void)
 #include <intrin.h>
 static unsigned long long cpucycles (void) { return __rdtsc (); }
 #else
-#error "Don't know how to count cycles on this platform!"
+/* No cycle counter: nanoseconds instead */
+static unsigned long long cpucycles (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 #endif
 
 void bench ()
@@ -113,8 +125,659 @@ void bench ()
     printf ("checksum: %02x\n", checksum);
 }
 
+/* Cost of processing a message in small blabla_stream_update calls */
+void bench_stream ()
+{
+#define STREAM_TOTAL 65536
+    static unsigned char buf[STREAM_TOTAL];
+    static unsigned char key[32];
+    static uint64_t nonce[2] = { 0, 0 };
+    static const int chunks[] = { 16, 64, 256, 1024, STREAM_TOTAL };
+    static unsigned char checksum = 0;
+    blabla_stream stream;
+    int c, i, pos;
+    printf ("#chunk  per byte (blabla_stream_update, %d bytes)\n", STREAM_TOTAL);
+
+    for (c = 0; c < sizeof (chunks) / sizeof (chunks[0]); ++c)
+    {
+        uint64_t cycles[BENCH_TRIALS];
+
+        for (i = 0; i < BENCH_TRIALS; ++i)
+        {
+            cycles[i] = cpucycles ();
+            ++nonce[0];
+            blabla_stream_init (&stream, (const uint8_t *)nonce, key);
+            for (pos = 0; pos < STREAM_TOTAL; pos += chunks[c])
+                blabla_stream_update (&stream, buf + pos, buf + pos, chunks[c]);
+            cycles[i] = cpucycles () - cycles[i];
+            checksum ^= buf[STREAM_TOTAL - 1];
+        }
+
+        qsort (cycles, BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+        printf ("%5d, %7.2f\n", chunks[c],
+                (double)cycles[BENCH_TRIALS / 2] / STREAM_TOTAL);
+    }
+    printf ("checksum: %02x\n", checksum);
+}
+
+/* Many short messages under different keys: blabla_xor one at a time vs
+ * blabla_xor_batch */
+void bench_batch ()
+{
+#define BATCH_COUNT 256
+#define BATCH_LEN 256
+    static unsigned char buf[BATCH_COUNT * BATCH_LEN];
+    static unsigned char keys[BATCH_COUNT][32];
+    static uint64_t nonces[BATCH_COUNT][2];
+    static blabla_job jobs[BATCH_COUNT];
+    static unsigned char checksum = 0;
+    uint64_t cycles[2][BENCH_TRIALS];
+    int i, j;
+    printf ("#batch  per byte (%d messages of %d bytes): blabla_xor, blabla_xor_batch\n",
+            BATCH_COUNT, BATCH_LEN);
+
+    for (j = 0; j < BATCH_COUNT; ++j)
+    {
+        for (i = 0; i < 32; ++i) keys[j][i] = i + j;
+        jobs[j].key = keys[j];
+        jobs[j].nonce = (const uint8_t *)nonces[j];
+        jobs[j].in = buf + j * BATCH_LEN;
+        jobs[j].out = buf + j * BATCH_LEN;
+        jobs[j].len = BATCH_LEN;
+    }
+
+    for (i = 0; i < BENCH_TRIALS; ++i)
+    {
+        cycles[0][i] = cpucycles ();
+        for (j = 0; j < BATCH_COUNT; ++j)
+            blabla_xor (buf + j * BATCH_LEN, buf + j * BATCH_LEN, BATCH_LEN,
+                        (const uint8_t *)nonces[j], keys[j]);
+        cycles[0][i] = cpucycles () - cycles[0][i];
+
+        cycles[1][i] = cpucycles ();
+        blabla_xor_batch (jobs, BATCH_COUNT);
+        cycles[1][i] = cpucycles () - cycles[1][i];
+        checksum ^= buf[BATCH_COUNT * BATCH_LEN - 1];
+    }
+
+    qsort (cycles[0], BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+    qsort (cycles[1], BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+    printf ("%5d, %7.2f, %7.2f\n", BATCH_LEN,
+            (double)cycles[0][BENCH_TRIALS / 2] / (BATCH_COUNT * BATCH_LEN),
+            (double)cycles[1][BENCH_TRIALS / 2] / (BATCH_COUNT * BATCH_LEN));
+    printf ("checksum: %02x\n", checksum);
+}
+
+/* Pages with the page number as nonce: blabla_xor on each page vs
+ * blabla_xor_sectors */
+void bench_sectors ()
+{
+#define SECTOR_TOTAL 262144
+    static unsigned char buf[SECTOR_TOTAL];
+    static unsigned char key[32];
+    static const int sizes[] = { 512, 4096 };
+    static unsigned char checksum = 0;
+    int c, i, j;
+    printf ("#sector per byte (%d bytes): blabla_xor, blabla_xor_sectors\n", SECTOR_TOTAL);
+
+    for (c = 0; c < sizeof (sizes) / sizeof (sizes[0]); ++c)
+    {
+        uint64_t cycles[2][BENCH_TRIALS];
+        int count = SECTOR_TOTAL / sizes[c];
+
+        for (i = 0; i < BENCH_TRIALS; ++i)
+        {
+            cycles[0][i] = cpucycles ();
+            for (j = 0; j < count; ++j)
+            {
+                uint64_t nonce[2] = { j, 0 };
+                blabla_xor (buf + j * sizes[c], buf + j * sizes[c], sizes[c],
+                            (const uint8_t *)nonce, key);
+            }
+            cycles[0][i] = cpucycles () - cycles[0][i];
+
+            cycles[1][i] = cpucycles ();
+            blabla_xor_sectors (buf, count, sizes[c], 0, key);
+            cycles[1][i] = cpucycles () - cycles[1][i];
+            checksum ^= buf[SECTOR_TOTAL - 1];
+        }
+
+        qsort (cycles[0], BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+        qsort (cycles[1], BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+        printf ("%5d, %7.2f, %7.2f\n", sizes[c],
+                (double)cycles[0][BENCH_TRIALS / 2] / SECTOR_TOTAL,
+                (double)cycles[1][BENCH_TRIALS / 2] / SECTOR_TOTAL);
+    }
+    printf ("checksum: %02x\n", checksum);
+}
+
+/* Cache pollution: time to read back a working set that fits in the last
+ * level cache, sized from it, after encrypting a buffer larger than it,
+ * either in one call (non-temporal stores) or in chunks under the threshold
+ * (regular stores), against the same read with nothing in between */
+static uint64_t pollution_read (const uint64_t *ws, uint64_t n, uint64_t *sum)
+{
+    uint64_t t = cpucycles ();
+    uint64_t j;
+
+    for (j = 0; j < n; ++j)
+        *sum += ws[j];
+    return cpucycles () - t;
+}
+
+void bench_pollution ()
+{
+#define POLLUTION_CHUNK (1 << 20)
+#define POLLUTION_TRIALS 8
+    static unsigned char key[32];
+    static uint64_t nonce[2] = { 0, 0 };
+    long llc = -1;
+    uint64_t len, wslen, resident[POLLUTION_TRIALS];
+    uint64_t *ws;
+    unsigned char *in, *out, *in64, *out64;
+    uint64_t sum = 0;
+    int mode, i;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    llc = sysconf (_SC_LEVEL3_CACHE_SIZE);
+    if (llc <= 0)
+        llc = sysconf (_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if (llc <= 0)
+        llc = 8 << 20;
+    /* Half of the cache, and four times it to encrypt, within bounds that
+     * keep the run short */
+    wslen = llc / 2;
+    wslen = wslen < (256 << 10) ? (256 << 10) : wslen > (32 << 20) ? (32 << 20) : wslen;
+    len = 4 * (uint64_t)llc;
+    len = len < (64 << 20) ? (64 << 20) : len > (256 << 20) ? (256 << 20) : len;
+    len -= len % POLLUTION_CHUNK;
+
+    ws = malloc (wslen);
+    in = malloc (len + 64);
+    out = malloc (len + 64);
+    in64 = in + (64 - (uintptr_t)in % 64);
+    out64 = out + (64 - (uintptr_t)out % 64);
+    printf ("#pollution (%llu KiB cache, %llu MiB encrypted, %llu KiB working set)"
+            "  per byte  working set read  vs resident\n",
+            (unsigned long long)llc >> 10, (unsigned long long)len >> 20,
+            (unsigned long long)wslen >> 10);
+    if (len <= (uint64_t)llc)
+        printf ("#the encrypted buffer fits in the cache, little pollution is expected\n");
+    printf ("#host dependent: cache sizes, inclusion and replacement policy\n");
+
+    memset (in, 0, len + 64);
+    memset (out, 0, len + 64);
+    for (i = 0; i < wslen / 8; ++i)
+        ws[i] = i;
+
+    for (i = 0; i < POLLUTION_TRIALS; ++i)
+    {
+        pollution_read (ws, wslen / 8, &sum);
+        resident[i] = pollution_read (ws, wslen / 8, &sum);
+    }
+    qsort (resident, POLLUTION_TRIALS, sizeof (uint64_t), bench_cmp);
+    printf ("%-10s %7s  %9llu\n", "resident,", "-",
+            (unsigned long long)resident[POLLUTION_TRIALS / 2]);
+
+    for (mode = 0; mode < 2; ++mode)
+    {
+        uint64_t cycles[2][POLLUTION_TRIALS];
+
+        for (i = 0; i < POLLUTION_TRIALS; ++i)
+        {
+            pollution_read (ws, wslen / 8, &sum);
+
+            ++nonce[0];
+            cycles[0][i] = cpucycles ();
+            if (mode == 0)
+            {
+                blabla_ctxt ctxt;
+                uint64_t pos;
+
+                blabla_ctxt_init (&ctxt, key, (const uint8_t *)nonce);
+                for (pos = 0; pos < len; pos += POLLUTION_CHUNK)
+                    blabla_ctxt_xor (&ctxt, in64 + pos, out64 + pos, POLLUTION_CHUNK);
+            }
+            else
+            {
+                blabla_xor (out64, in64, len, (const uint8_t *)nonce, key);
+            }
+            cycles[0][i] = cpucycles () - cycles[0][i];
+
+            cycles[1][i] = pollution_read (ws, wslen / 8, &sum);
+        }
+
+        qsort (cycles[0], POLLUTION_TRIALS, sizeof (uint64_t), bench_cmp);
+        qsort (cycles[1], POLLUTION_TRIALS, sizeof (uint64_t), bench_cmp);
+        printf ("%-10s %7.2f  %9llu  %9.2fx\n", mode == 0 ? "regular," : "streaming,",
+                (double)cycles[0][POLLUTION_TRIALS / 2] / len,
+                (unsigned long long)cycles[1][POLLUTION_TRIALS / 2],
+                (double)cycles[1][POLLUTION_TRIALS / 2] / resident[POLLUTION_TRIALS / 2]);
+    }
+    printf ("checksum: %02x\n", (unsigned)((sum ^ out64[len - 1]) & 0xff));
+
+    free (ws);
+    free (in);
+    free (out);
+}
+
+void bench_rng ()
+{
+#define RNG_TOTAL 65536
+    static unsigned char buf[RNG_TOTAL];
+    static const int draws[] = { 8, 16, 64, 256, 4096, RNG_TOTAL };
+    static unsigned char checksum = 0;
+    int d, i, pos;
+    printf ("#draw  per byte (blabla_rng_bytes, %d bytes)\n", RNG_TOTAL);
+
+    blabla_rng_bytes (buf, RNG_TOTAL);
+    for (d = 0; d < sizeof (draws) / sizeof (draws[0]); ++d)
+    {
+        uint64_t cycles[BENCH_TRIALS];
+
+        for (i = 0; i < BENCH_TRIALS; ++i)
+        {
+            cycles[i] = cpucycles ();
+            for (pos = 0; pos < RNG_TOTAL; pos += draws[d])
+                blabla_rng_bytes (buf + pos, draws[d]);
+            cycles[i] = cpucycles () - cycles[i];
+            checksum ^= buf[RNG_TOTAL - 1];
+        }
+
+        qsort (cycles, BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+        printf ("%5d, %7.2f\n", draws[d],
+                (double)cycles[BENCH_TRIALS / 2] / RNG_TOTAL);
+    }
+    printf ("checksum: %02x\n", checksum);
+}
+
+void bench_prng ()
+{
+#define PRNG_TOTAL 8192
+    static uint64_t words[PRNG_TOTAL];
+    static double doubles[PRNG_TOTAL];
+    static unsigned char seed[32];
+    static const char *names[] = { "u64", "double", "bounded" };
+    uint64_t checksum = 0;
+    blabla_prng rng;
+    int f, i;
+    printf ("#fill    per value (blabla_prng, %d values)\n", PRNG_TOTAL);
+
+    blabla_prng_init (&rng, seed, 0);
+    for (f = 0; f < 3; ++f)
+    {
+        uint64_t cycles[BENCH_TRIALS];
+
+        for (i = 0; i < BENCH_TRIALS; ++i)
+        {
+            cycles[i] = cpucycles ();
+            if (f == 0)
+                blabla_prng_fill_u64 (&rng, words, PRNG_TOTAL);
+            else if (f == 1)
+                blabla_prng_fill_double (&rng, doubles, PRNG_TOTAL);
+            else
+                blabla_prng_fill_bounded (&rng, words, PRNG_TOTAL, 1000003);
+            cycles[i] = cpucycles () - cycles[i];
+            checksum += words[PRNG_TOTAL - 1] + (uint64_t)(doubles[PRNG_TOTAL - 1] * 1000);
+        }
+
+        qsort (cycles, BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+        printf ("%-8s %7.2f\n", names[f],
+                (double)cycles[BENCH_TRIALS / 2] / PRNG_TOTAL);
+    }
+    printf ("checksum: %02x\n", (unsigned)(checksum & 0xff));
+}
+
+void bench_aead ()
+{
+#define AEAD_MAX 65536
+    static unsigned char buf[AEAD_MAX];
+    static unsigned char key[32];
+    static uint64_t nonce[2] = { 0, 0 };
+    static const int lens[] = { 64, 1024, 16384, AEAD_MAX };
+    static unsigned char checksum = 0;
+    unsigned char tag[16];
+    int l, mode, i;
+    printf ("#bytes   per byte: xor  aead  xor+poly1305\n");
+
+    for (l = 0; l < sizeof (lens) / sizeof (lens[0]); ++l)
+    {
+        printf ("%6d,", lens[l]);
+        for (mode = 0; mode < 3; ++mode)
+        {
+            uint64_t cycles[BENCH_TRIALS];
+
+            for (i = 0; i < BENCH_TRIALS; ++i)
+            {
+                ++nonce[0];
+                cycles[i] = cpucycles ();
+                if (mode == 1)
+                {
+                    blabla_aead_encrypt (buf, tag, buf, lens[l], NULL, 0, (const uint8_t *)nonce, key);
+                }
+                else
+                {
+                    blabla_xor (buf, buf, lens[l], (const uint8_t *)nonce, key);
+                    if (mode == 2)
+                        blabla_poly1305 (tag, buf, lens[l], key);
+                }
+                cycles[i] = cpucycles () - cycles[i];
+                checksum ^= buf[lens[l] - 1] ^ tag[0];
+            }
+
+            qsort (cycles, BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+            printf (" %5.2f", (double)cycles[BENCH_TRIALS / 2] / lens[l]);
+        }
+        printf ("\n");
+    }
+    printf ("checksum: %02x\n", checksum);
+}
+
+/* Subkeys of extended nonces: hblabla one at a time vs hblabla_batch */
+void bench_hblabla ()
+{
+#define HBLABLA_COUNT 256
+    static unsigned char in[HBLABLA_COUNT * 16];
+    static unsigned char out[HBLABLA_COUNT * 32];
+    static unsigned char key[32];
+    static unsigned char checksum = 0;
+    uint64_t cycles[2][BENCH_TRIALS];
+    int i, j;
+    printf ("#hblabla  per subkey (%d subkeys): hblabla, hblabla_batch\n", HBLABLA_COUNT);
+
+    for (i = 0; i < HBLABLA_COUNT * 16; ++i)
+        in[i] = i;
+
+    for (i = 0; i < BENCH_TRIALS; ++i)
+    {
+        cycles[0][i] = cpucycles ();
+        for (j = 0; j < HBLABLA_COUNT; ++j)
+            hblabla (out + 32 * j, in + 16 * j, key);
+        cycles[0][i] = cpucycles () - cycles[0][i];
+        checksum ^= out[0];
+
+        cycles[1][i] = cpucycles ();
+        hblabla_batch (out, in, HBLABLA_COUNT, key);
+        cycles[1][i] = cpucycles () - cycles[1][i];
+        checksum ^= out[HBLABLA_COUNT * 32 - 1];
+        in[i % (HBLABLA_COUNT * 16)] ^= checksum;
+    }
+
+    qsort (cycles[0], BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+    qsort (cycles[1], BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+    printf ("%7.1f, %7.1f\n",
+            (double)cycles[0][BENCH_TRIALS / 2] / HBLABLA_COUNT,
+            (double)cycles[1][BENCH_TRIALS / 2] / HBLABLA_COUNT);
+    printf ("checksum: %02x\n", checksum);
+}
+
+/* blabla_permute on each layout, with feed-forward */
+void bench_permute ()
+{
+#define PERMUTE_COUNT 256
+    static uint64_t states[PERMUTE_COUNT * 16];
+    static unsigned char checksum = 0;
+    uint64_t cycles[2][BENCH_TRIALS];
+    int i;
+    printf ("#permute  per state (%d states): AoS, SoA\n", PERMUTE_COUNT);
+
+    for (i = 0; i < PERMUTE_COUNT * 16; ++i)
+        states[i] = i;
+
+    for (i = 0; i < BENCH_TRIALS; ++i)
+    {
+        cycles[0][i] = cpucycles ();
+        blabla_permute (states, PERMUTE_COUNT, BLABLA_PERMUTE_FEEDFORWARD);
+        cycles[0][i] = cpucycles () - cycles[0][i];
+
+        cycles[1][i] = cpucycles ();
+        blabla_permute (states, PERMUTE_COUNT, BLABLA_PERMUTE_SOA | BLABLA_PERMUTE_FEEDFORWARD);
+        cycles[1][i] = cpucycles () - cycles[1][i];
+        checksum ^= (unsigned char)states[PERMUTE_COUNT * 16 - 1];
+    }
+
+    qsort (cycles[0], BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+    qsort (cycles[1], BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+    printf ("%7.1f, %7.1f\n",
+            (double)cycles[0][BENCH_TRIALS / 2] / PERMUTE_COUNT,
+            (double)cycles[1][BENCH_TRIALS / 2] / PERMUTE_COUNT);
+    printf ("checksum: %02x\n", checksum);
+}
+
+/* Short messages under a raw key vs a prepared key */
+void bench_with_key ()
+{
+    static unsigned char buf[1024];
+    static unsigned char key[32];
+    static uint64_t nonce[2] = { 0, 0 };
+    static const int lens[] = { 64, 256, 1024 };
+    static unsigned char checksum = 0;
+    blabla_key pk;
+    int l, mode, i;
+    printf ("#bytes   per message: blabla_xor  blabla_xor_with_key\n");
+
+    blabla_key_init (&pk, key);
+    for (l = 0; l < sizeof (lens) / sizeof (lens[0]); ++l)
+    {
+        printf ("%6d,", lens[l]);
+        for (mode = 0; mode < 2; ++mode)
+        {
+            uint64_t cycles[BENCH_TRIALS];
+
+            for (i = 0; i < BENCH_TRIALS; ++i)
+            {
+                ++nonce[0];
+                cycles[i] = cpucycles ();
+                if (mode == 0)
+                    blabla_xor (buf, buf, lens[l], (const uint8_t *)nonce, key);
+                else
+                    blabla_xor_with_key (buf, buf, lens[l], (const uint8_t *)nonce, &pk);
+                cycles[i] = cpucycles () - cycles[i];
+                checksum ^= buf[lens[l] - 1];
+            }
+
+            qsort (cycles, BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+            printf (" %7llu", (unsigned long long)cycles[BENCH_TRIALS / 2]);
+        }
+        printf ("\n");
+    }
+    printf ("checksum: %02x\n", checksum);
+}
+
+/* A message kept as a chain of fragments (a 54-byte header, then payloads of
+ * frag bytes): gather into a staging buffer, blabla_xor and scatter back,
+ * against blabla_xorv on the chain */
+void bench_xorv ()
+{
+#define XORV_TOTAL 65536
+    static unsigned char buf[XORV_TOTAL], staging[XORV_TOTAL];
+    static unsigned char key[32];
+    static uint64_t nonce[2] = { 0, 0 };
+    static const int frags[] = { 512, 1448, 8192 };
+    static unsigned char checksum = 0;
+    struct iovec iov[XORV_TOTAL / 512 + 2];
+    int c, i, j, count;
+    printf ("#iovec per byte (%d bytes): staging + blabla_xor, blabla_xorv\n", XORV_TOTAL);
+
+    for (c = 0; c < sizeof (frags) / sizeof (frags[0]); ++c)
+    {
+        uint64_t cycles[2][BENCH_TRIALS];
+        uint64_t pos;
+
+        iov[0].iov_base = buf;
+        iov[0].iov_len = 54;
+        for (pos = 54, count = 1; pos < XORV_TOTAL; pos += iov[count++].iov_len)
+        {
+            iov[count].iov_base = buf + pos;
+            iov[count].iov_len = XORV_TOTAL - pos < frags[c] ? XORV_TOTAL - pos : frags[c];
+        }
+
+        for (i = 0; i < BENCH_TRIALS; ++i)
+        {
+            ++nonce[0];
+            cycles[0][i] = cpucycles ();
+            for (pos = 0, j = 0; j < count; pos += iov[j++].iov_len)
+                memcpy (staging + pos, iov[j].iov_base, iov[j].iov_len);
+            blabla_xor (staging, staging, XORV_TOTAL, (const uint8_t *)nonce, key);
+            for (pos = 0, j = 0; j < count; pos += iov[j++].iov_len)
+                memcpy (iov[j].iov_base, staging + pos, iov[j].iov_len);
+            cycles[0][i] = cpucycles () - cycles[0][i];
+
+            cycles[1][i] = cpucycles ();
+            blabla_xorv (iov, count, iov, count, (const uint8_t *)nonce, key);
+            cycles[1][i] = cpucycles () - cycles[1][i];
+            checksum ^= buf[XORV_TOTAL - 1];
+        }
+
+        qsort (cycles[0], BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+        qsort (cycles[1], BENCH_TRIALS, sizeof (uint64_t), bench_cmp);
+        printf ("%5d, %7.2f, %7.2f\n", frags[c],
+                (double)cycles[0][BENCH_TRIALS / 2] / XORV_TOTAL,
+                (double)cycles[1][BENCH_TRIALS / 2] / XORV_TOTAL);
+    }
+    printf ("checksum: %02x\n", checksum);
+}
+
+/* Many small requests: one blabla_xor each on the calling thread, against
+ * submitting them all to an engine and waiting for the last one */
+void bench_engine ()
+{
+#define ENGINE_REQS 1024
+    static unsigned char buf[ENGINE_REQS * 1024];
+    static unsigned char key[32];
+    static uint64_t nonces[ENGINE_REQS][2];
+    static blabla_request reqs[ENGINE_REQS];
+    static const int lens[] = { 64, 256, 1024 };
+    static unsigned char checksum = 0;
+    blabla_engine *engine = blabla_engine_create (0, ENGINE_REQS);
+    blabla_engine_stats stats;
+    int l, i, j;
+    printf ("#engine  per request (%d requests): blabla_xor, engine, mean latency (ns)\n", ENGINE_REQS);
+
+    if (engine == NULL)
+        return;
+    for (l = 0; l < sizeof (lens) / sizeof (lens[0]); ++l)
+    {
+        uint64_t cycles[2][BENCH_TRIALS / 8];
+
+        for (i = 0; i < BENCH_TRIALS / 8; ++i)
+        {
+            cycles[0][i] = cpucycles ();
+            for (j = 0; j < ENGINE_REQS; ++j)
+            {
+                nonces[j][0] = j;
+                blabla_xor (buf + j * lens[l], buf + j * lens[l], lens[l], (const uint8_t *)nonces[j], key);
+            }
+            cycles[0][i] = cpucycles () - cycles[0][i];
+
+            cycles[1][i] = cpucycles ();
+            for (j = 0; j < ENGINE_REQS; ++j)
+            {
+                reqs[j].job.key = key;
+                reqs[j].job.nonce = (const uint8_t *)nonces[j];
+                reqs[j].job.in = buf + j * lens[l];
+                reqs[j].job.out = buf + j * lens[l];
+                reqs[j].job.len = lens[l];
+                reqs[j].done = NULL;
+                reqs[j].fd = -1;
+                while (blabla_engine_submit (engine, &reqs[j]) != 0)
+                    sched_yield ();
+            }
+            for (j = 0; j < ENGINE_REQS; ++j)
+                while (!blabla_request_done (&reqs[j]))
+                    sched_yield ();
+            cycles[1][i] = cpucycles () - cycles[1][i];
+            checksum ^= buf[lens[l] - 1];
+        }
+
+        qsort (cycles[0], BENCH_TRIALS / 8, sizeof (uint64_t), bench_cmp);
+        qsort (cycles[1], BENCH_TRIALS / 8, sizeof (uint64_t), bench_cmp);
+        printf ("%6d, %7llu, %7llu", lens[l],
+                (unsigned long long)cycles[0][BENCH_TRIALS / 16] / ENGINE_REQS,
+                (unsigned long long)cycles[1][BENCH_TRIALS / 16] / ENGINE_REQS);
+        blabla_engine_get_stats (engine, &stats);
+        printf (", %9llu\n", (unsigned long long)(stats.latency_sum / stats.completed));
+    }
+    blabla_engine_destroy (engine);
+    printf ("checksum: %02x\n", checksum);
+}
+
+/* Latency of single packets on one session: keystream computed inline by
+ * blabla_stream_update, against a blabla_ring refilled between packets
+ * (outside the timed call) or by its background thread */
+void bench_ring ()
+{
+#define RING_PACKETS 8192
+    static unsigned char buf[2048];
+    static unsigned char key[32];
+    static uint64_t nonce[2] = { 0, 0 };
+    static uint64_t cycles[3][RING_PACKETS];
+    static const int lens[] = { 64, 512, 1400 };
+    static const char *names[] = { "inline", "ring (idle)", "ring (thread)" };
+    static unsigned char checksum = 0;
+    blabla_stream stream;
+    int l, m, i;
+    printf ("#ring  per packet (%d packets): p50, p99, p999\n", RING_PACKETS);
+
+    for (l = 0; l < sizeof (lens) / sizeof (lens[0]); ++l)
+    {
+        blabla_ring *rings[2];
+
+        ++nonce[0];
+        blabla_stream_init (&stream, (const uint8_t *)nonce, key);
+        rings[0] = blabla_ring_create ((const uint8_t *)nonce, key, 65536, 0);
+        rings[1] = blabla_ring_create ((const uint8_t *)nonce, key, 65536, 1);
+        if (rings[0] == NULL || rings[1] == NULL)
+            return;
+
+        for (i = 0; i < RING_PACKETS; ++i)
+        {
+            cycles[0][i] = cpucycles ();
+            blabla_stream_update (&stream, buf, buf, lens[l]);
+            cycles[0][i] = cpucycles () - cycles[0][i];
+
+            blabla_ring_fill (rings[0]);
+            cycles[1][i] = cpucycles ();
+            blabla_ring_xor (rings[0], buf, buf, lens[l]);
+            cycles[1][i] = cpucycles () - cycles[1][i];
+
+            cycles[2][i] = cpucycles ();
+            blabla_ring_xor (rings[1], buf, buf, lens[l]);
+            cycles[2][i] = cpucycles () - cycles[2][i];
+            checksum ^= buf[lens[l] - 1];
+        }
+        blabla_stream_final (&stream);
+        blabla_ring_destroy (rings[0]);
+        blabla_ring_destroy (rings[1]);
+
+        for (m = 0; m < 3; ++m)
+        {
+            qsort (cycles[m], RING_PACKETS, sizeof (uint64_t), bench_cmp);
+            printf ("%5d %-14s %7llu, %7llu, %7llu\n", lens[l], names[m],
+                    (unsigned long long)cycles[m][RING_PACKETS / 2],
+                    (unsigned long long)cycles[m][RING_PACKETS * 99 / 100],
+                    (unsigned long long)cycles[m][RING_PACKETS * 999 / 1000]);
+        }
+    }
+    printf ("checksum: %02x\n", checksum);
+}
+
 int main ()
 {
     bench ();
+    bench_stream ();
+    bench_batch ();
+    bench_sectors ();
+    bench_pollution ();
+    bench_rng ();
+    bench_prng ();
+    bench_aead ();
+    bench_hblabla ();
+    bench_permute ();
+    bench_with_key ();
+    bench_xorv ();
+    bench_engine ();
+    bench_ring ();
     return 0;
 }
@@ -0,0 +1,349 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+/*
+ * blabla-crypt: encrypts or decrypts a file or stdin with BlaBla.
+ *
+ * Reading, encrypting and writing overlap in a pipeline of NBUF buffers: a
+ * reader thread fills them, the main thread encrypts them in place and a
+ * writer thread empties them. A regular input file is mapped instead, and
+ * the main thread encrypts from the mapping into empty buffers.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "blabla.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define NBUF 3
+/* A whole number of blocks, so that the context continues the keystream */
+#define BUF_LEN (4 << 20)
+
+enum
+{
+    SLOT_EMPTY,
+    SLOT_READ,
+    SLOT_ENCRYPTED
+};
+
+typedef struct
+{
+    uint8_t *data;
+    uint64_t len; /* 0 marks the end of the input */
+    int state;
+} slot;
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    slot slots[NBUF];
+    int in_fd;
+    int out_fd;
+} pipe_ = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+
+static void die (const char *what)
+{
+    fprintf (stderr, "blabla-crypt: %s: %s\n", what, strerror (errno));
+    exit (1);
+}
+
+static slot *slot_wait (uint64_t i, int state)
+{
+    slot *s = &pipe_.slots[i % NBUF];
+
+    pthread_mutex_lock (&pipe_.lock);
+    while (s->state != state)
+        pthread_cond_wait (&pipe_.cond, &pipe_.lock);
+    pthread_mutex_unlock (&pipe_.lock);
+    return s;
+}
+
+static void slot_set (slot *s, int state)
+{
+    pthread_mutex_lock (&pipe_.lock);
+    s->state = state;
+    pthread_cond_broadcast (&pipe_.cond);
+    pthread_mutex_unlock (&pipe_.lock);
+}
+
+static void *reader (void *arg)
+{
+    uint64_t i;
+
+    (void)arg;
+    for (i = 0;; ++i)
+    {
+        slot *s = slot_wait (i, SLOT_EMPTY);
+
+        /* Only the last buffer may be partial */
+        s->len = 0;
+        while (s->len < BUF_LEN)
+        {
+            ssize_t r = read (pipe_.in_fd, s->data + s->len, BUF_LEN - s->len);
+
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0)
+                die ("read");
+            if (r == 0)
+                break;
+            s->len += r;
+        }
+
+        slot_set (s, SLOT_READ);
+        if (s->len < BUF_LEN)
+            break;
+    }
+    return NULL;
+}
+
+static void *writer (void *arg)
+{
+    uint64_t i;
+
+    (void)arg;
+    for (i = 0;; ++i)
+    {
+        slot *s = slot_wait (i, SLOT_ENCRYPTED);
+        uint64_t pos = 0;
+        uint64_t len = s->len;
+
+        while (pos < len)
+        {
+            ssize_t w = write (pipe_.out_fd, s->data + pos, len - pos);
+
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w < 0)
+                die ("write");
+            pos += w;
+        }
+
+        slot_set (s, SLOT_EMPTY);
+        if (len < BUF_LEN)
+            break;
+    }
+    return NULL;
+}
+
+static int parse_hex (const char *hex, uint8_t *out, size_t len)
+{
+    size_t i;
+
+    if (strlen (hex) != 2 * len)
+        return -1;
+    for (i = 0; i < 2 * len; ++i)
+    {
+        char c = hex[i];
+        int v = c >= '0' && c <= '9' ? c - '0'
+              : c >= 'a' && c <= 'f' ? c - 'a' + 10
+              : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+
+        if (v < 0)
+            return -1;
+        out[i / 2] = (i % 2 == 0) ? v << 4 : out[i / 2] | v;
+    }
+    return 0;
+}
+
+static int read_key_file (const char *path, uint8_t *key)
+{
+    int fd = open (path, O_RDONLY);
+    ssize_t r;
+
+    if (fd < 0)
+        return -1;
+    r = read (fd, key, 32);
+    close (fd);
+    return r == 32 ? 0 : -1;
+}
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Time spent in encryption: cycles where the TSC is available, nanoseconds
+ * elsewhere */
+#if defined(__x86_64__) || defined(__i386__)
+#define TICK_UNIT "cycles"
+static unsigned long long ticks (void)
+{
+    return __rdtsc ();
+}
+#else
+#define TICK_UNIT "ns"
+static unsigned long long ticks (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+static void usage (void)
+{
+    fprintf (stderr,
+             "usage: blabla-crypt (-k keyfile | -K hexkey) [-n hexnonce] [-v] [in [out]]\n"
+             "  Encrypts or decrypts in (default stdin) to out (default stdout).\n"
+             "  -k  file whose first 32 bytes are the key\n"
+             "  -K  key as 64 hex digits\n"
+             "  -n  nonce as 32 hex digits (default zero)\n"
+             "  -v  report throughput and " TICK_UNIT " per byte on stderr\n");
+    exit (2);
+}
+
+int main (int argc, char **argv)
+{
+    uint8_t key[32];
+    uint8_t nonce[16] = { 0 };
+    int have_key = 0;
+    int verbose = 0;
+    const uint8_t *map = NULL;
+    uint64_t map_len = 0;
+    pthread_t rthread, wthread;
+    blabla_ctxt ctxt;
+    struct stat st;
+    uint64_t total = 0;
+    unsigned long long cycles = 0;
+    double start;
+    uint64_t i;
+    int c;
+
+    while ((c = getopt (argc, argv, "k:K:n:v")) != -1)
+    {
+        switch (c)
+        {
+        case 'k':
+            if (read_key_file (optarg, key) != 0)
+            {
+                fprintf (stderr, "blabla-crypt: cannot read 32 bytes from %s\n", optarg);
+                return 1;
+            }
+            have_key = 1;
+            break;
+        case 'K':
+            if (parse_hex (optarg, key, 32) != 0)
+                usage ();
+            have_key = 1;
+            break;
+        case 'n':
+            if (parse_hex (optarg, nonce, 16) != 0)
+                usage ();
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage ();
+        }
+    }
+    if (!have_key || argc - optind > 2)
+        usage ();
+
+    pipe_.in_fd = STDIN_FILENO;
+    pipe_.out_fd = STDOUT_FILENO;
+    if (argc - optind >= 1 && strcmp (argv[optind], "-") != 0)
+    {
+        pipe_.in_fd = open (argv[optind], O_RDONLY);
+        if (pipe_.in_fd < 0)
+            die (argv[optind]);
+    }
+    if (argc - optind == 2 && strcmp (argv[optind + 1], "-") != 0)
+    {
+        pipe_.out_fd = open (argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (pipe_.out_fd < 0)
+            die (argv[optind + 1]);
+    }
+
+    /* Regular input files are encrypted straight from the page cache */
+    if (fstat (pipe_.in_fd, &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0)
+    {
+        void *p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, pipe_.in_fd, 0);
+
+        if (p != MAP_FAILED)
+        {
+            madvise (p, st.st_size, MADV_SEQUENTIAL);
+            map = p;
+            map_len = st.st_size;
+        }
+    }
+
+    for (i = 0; i < NBUF; ++i)
+    {
+        void *p;
+
+        if (posix_memalign (&p, 4096, BUF_LEN) != 0)
+            die ("malloc");
+        pipe_.slots[i].data = p;
+        pipe_.slots[i].state = SLOT_EMPTY;
+    }
+
+    blabla_ctxt_init (&ctxt, key, nonce);
+    start = now ();
+    if (map == NULL && pthread_create (&rthread, NULL, reader, NULL) != 0)
+        die ("pthread_create");
+    if (pthread_create (&wthread, NULL, writer, NULL) != 0)
+        die ("pthread_create");
+
+    for (i = 0;; ++i)
+    {
+        slot *s = slot_wait (i, map != NULL ? SLOT_EMPTY : SLOT_READ);
+        unsigned long long t;
+
+        if (map != NULL)
+        {
+            uint64_t off = i * (uint64_t)BUF_LEN;
+
+            s->len = map_len - off < BUF_LEN ? map_len - off : BUF_LEN;
+            t = ticks ();
+            blabla_ctxt_xor (&ctxt, map + off, s->data, s->len);
+        }
+        else
+        {
+            t = ticks ();
+            blabla_ctxt_xor (&ctxt, s->data, s->data, s->len);
+        }
+        cycles += ticks () - t;
+        total += s->len;
+
+        slot_set (s, SLOT_ENCRYPTED);
+        if (s->len < BUF_LEN)
+            break;
+    }
+
+    if (map == NULL)
+        pthread_join (rthread, NULL);
+    pthread_join (wthread, NULL);
+    if (pipe_.out_fd != STDOUT_FILENO && close (pipe_.out_fd) != 0)
+        die ("close");
+
+    if (verbose)
+    {
+        double elapsed = now () - start;
+
+        fprintf (stderr, "%llu bytes in %.3f s: %.1f MB/s, %.2f " TICK_UNIT "/byte (%s)\n",
+                 (unsigned long long)total, elapsed, total / elapsed / 1e6,
+                 total ? (double)cycles / total : 0.0, blabla_backend_name ());
+    }
+    return 0;
+}
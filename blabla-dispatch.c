@@ -0,0 +1,215 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+/*
+ * Runtime dispatch for libblabla: each backend is built from blabla-opt.c
+ * with its own compiler flags, and the fastest one supported by the CPU is
+ * selected once at load time. Setting BLABLA_BACKEND=<name> in the
+ * environment forces a given backend (if the CPU supports it).
+ */
+
+#ifdef SUPERCOP
+#include "crypto_stream.h"
+#endif
+
+#include "dispatch.h"
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BLABLA_X86
+#endif
+
+/* Fastest first; off x86, only the generic backend is built */
+static const blabla_backend *const backends[] = {
+#ifdef BLABLA_X86
+    &blabla_backend_avx512,
+    &blabla_backend_avx512vl,
+    &blabla_backend_avx2,
+    &blabla_backend_ssse3,
+    &blabla_backend_sse2,
+#endif
+    &blabla_backend_generic,
+};
+
+#define NBACKENDS (sizeof (backends) / sizeof (backends[0]))
+
+static const blabla_backend *backend;
+
+
+static int cpu_supports (const blabla_backend *b)
+{
+#ifdef BLABLA_X86
+    __builtin_cpu_init ();
+
+    if (!strcmp (b->name, "avx512") || !strcmp (b->name, "avx512vl"))
+        return __builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512vl")
+               && __builtin_cpu_supports ("avx512bw");
+    if (!strcmp (b->name, "avx2"))
+        return __builtin_cpu_supports ("avx2");
+    if (!strcmp (b->name, "ssse3"))
+        return __builtin_cpu_supports ("ssse3");
+    if (!strcmp (b->name, "sse2"))
+        return __builtin_cpu_supports ("sse2");
+#endif
+    if (!strcmp (b->name, "generic"))
+        return 1;
+    return 0;
+}
+
+static const blabla_backend *blabla_select (void)
+{
+    const char *force = getenv ("BLABLA_BACKEND");
+    unsigned i;
+
+    if (force != NULL)
+    {
+        for (i = 0; i < NBACKENDS; ++i)
+        {
+            if (!strcmp (backends[i]->name, force) && cpu_supports (backends[i]))
+                return backends[i];
+        }
+    }
+
+    for (i = 0; i < NBACKENDS; ++i)
+    {
+        if (cpu_supports (backends[i]))
+            return backends[i];
+    }
+
+    return &blabla_backend_generic;
+}
+
+__attribute__ ((constructor)) static void blabla_dispatch_init (void)
+{
+    __atomic_store_n (&backend, blabla_select (), __ATOMIC_RELEASE);
+}
+
+/* Also covers calls made from other constructors before ours has run */
+static const blabla_backend *blabla_get_backend (void)
+{
+    const blabla_backend *b = __atomic_load_n (&backend, __ATOMIC_ACQUIRE);
+
+    if (b == NULL)
+    {
+        b = blabla_select ();
+        __atomic_store_n (&backend, b, __ATOMIC_RELEASE);
+    }
+    return b;
+}
+
+
+const char *blabla_backend_name (void)
+{
+    return blabla_get_backend ()->name;
+}
+
+void blabla_ctxt_init (blabla_ctxt *ctxt, const uint8_t *key, const uint8_t *nonce)
+{
+    blabla_get_backend ()->ctxt_init (ctxt, key, nonce);
+}
+
+void blabla_ctxt_init_zero (blabla_ctxt *ctxt, const uint8_t *key)
+{
+    blabla_get_backend ()->ctxt_init_zero (ctxt, key);
+}
+
+void blabla_ctxt_keystream (blabla_ctxt *ctxt, uint8_t *out, uint64_t len)
+{
+    blabla_get_backend ()->ctxt_keystream (ctxt, out, len);
+}
+
+void blabla_ctxt_xor (blabla_ctxt *ctxt, const uint8_t *in, uint8_t *out, uint64_t len)
+{
+    blabla_get_backend ()->ctxt_xor (ctxt, in, out, len);
+}
+
+int blabla_keystream (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k)
+{
+    return blabla_get_backend ()->keystream (out, outlen, n, k);
+}
+
+#ifdef SUPERCOP
+int crypto_stream (unsigned char *out,
+                   unsigned long long outlen,
+                   const unsigned char *n,
+                   const unsigned char *k)
+{
+    return blabla_keystream (out, outlen, n, k);
+}
+#endif
+
+int blabla_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k)
+{
+    return blabla_get_backend ()->xor (out, in, inlen, n, k);
+}
+
+#ifdef SUPERCOP
+int crypto_stream_xor (unsigned char *out,
+                       const unsigned char *in,
+                       unsigned long long inlen,
+                       const unsigned char *n,
+                       const unsigned char *k)
+{
+    return blabla_xor (out, in, inlen, n, k);
+}
+#endif
+
+int blabla_xor_batch (const blabla_job *jobs, uint64_t count)
+{
+    return blabla_get_backend ()->xor_batch (jobs, count);
+}
+
+int blabla_xor_sectors (uint8_t *buf, uint64_t nsectors, uint64_t sector_size, uint64_t first_index, const uint8_t *k)
+{
+    return blabla_get_backend ()->xor_sectors (buf, nsectors, sector_size, first_index, k);
+}
+
+int blabla_keystream_rounds (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k, int rounds)
+{
+    return blabla_get_backend ()->keystream_rounds (out, outlen, n, k, rounds);
+}
+
+int blabla_xor_rounds (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k, int rounds)
+{
+    return blabla_get_backend ()->xor_rounds (out, in, inlen, n, k, rounds);
+}
+
+void blabla_ctxt_double (blabla_ctxt *ctxt, double *out, uint64_t n)
+{
+    blabla_get_backend ()->ctxt_double (ctxt, out, n);
+}
+
+int blabla_aead_encrypt (uint8_t *c, uint8_t *tag, const uint8_t *m, uint64_t mlen,
+                         const uint8_t *ad, uint64_t adlen, const uint8_t *n, const uint8_t *k)
+{
+    return blabla_get_backend ()->aead_encrypt (c, tag, m, mlen, ad, adlen, n, k);
+}
+
+int blabla_aead_decrypt (uint8_t *m, const uint8_t *c, uint64_t clen, const uint8_t *tag,
+                         const uint8_t *ad, uint64_t adlen, const uint8_t *n, const uint8_t *k)
+{
+    return blabla_get_backend ()->aead_decrypt (m, c, clen, tag, ad, adlen, n, k);
+}
+
+void hblabla_batch (uint8_t *out, const uint8_t *in, uint64_t count, const uint8_t *k)
+{
+    blabla_get_backend ()->hblabla_batch (out, in, count, k);
+}
+
+void blabla_permute (uint64_t *states, uint64_t count, int flags)
+{
+    blabla_get_backend ()->permute (states, count, flags);
+}
+
+int blabla_keystream_with_key (uint8_t *out, uint64_t outlen, const uint8_t *n, const blabla_key *key)
+{
+    return blabla_get_backend ()->keystream_with_key (out, outlen, n, key);
+}
+
+int blabla_xor_with_key (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const blabla_key *key)
+{
+    return blabla_get_backend ()->xor_with_key (out, in, inlen, n, key);
+}
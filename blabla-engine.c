@@ -0,0 +1,401 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+/*
+ * Asynchronous engine: callers submit requests to a bounded lock-free MPMC
+ * queue (Vyukov's ring, one sequence number per cell) and return at once;
+ * worker threads drain it.
+ *
+ * A worker that pops a small request keeps popping small requests and runs
+ * them together through blabla_xor_batch, one message per SIMD lane. A large
+ * request is pushed once per worker that may help with it: every copy takes
+ * counter-aligned chunks from a shared index, as in blabla-mt.c, and the
+ * last copy to finish completes the request.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "blabla.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ENGINE_MAX_WORKERS 64
+/* Requests up to this length are batched, above ENGINE_SPLIT_LEN they are
+ * split in chunks of ENGINE_CHUNK bytes (a whole number of cores for every
+ * backend) */
+#define ENGINE_BATCH_LEN (4 * BLABLA_STREAM_BUFLEN)
+#define ENGINE_BATCH_MAX 32
+#define ENGINE_SPLIT_LEN (1 << 18)
+#define ENGINE_CHUNK     (64 * BLABLA_STREAM_BUFLEN)
+/* Failed pops before a worker goes to sleep */
+#define ENGINE_SPINS 256
+
+typedef struct
+{
+    uint64_t seq;
+    blabla_request *req;
+} engine_cell;
+
+struct blabla_engine
+{
+    engine_cell *cells;
+    uint64_t mask;
+    uint64_t head __attribute__ ((aligned (64)));
+    uint64_t tail __attribute__ ((aligned (64)));
+
+    pthread_mutex_t lock __attribute__ ((aligned (64)));
+    pthread_cond_t wake;
+    int idle; /* workers waiting on wake */
+    int stop;
+    int nworkers;
+    pthread_t workers[ENGINE_MAX_WORKERS];
+
+    blabla_engine_stats stats;
+};
+
+
+static uint64_t engine_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int engine_push (blabla_engine *e, blabla_request *req)
+{
+    uint64_t pos = __atomic_load_n (&e->tail, __ATOMIC_RELAXED);
+    engine_cell *cell;
+
+    for (;;)
+    {
+        int64_t diff;
+
+        cell = &e->cells[pos & e->mask];
+        diff = (int64_t)(__atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n (&e->tail, &pos, pos + 1, 1,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return -1; /* full */
+        }
+        else
+        {
+            pos = __atomic_load_n (&e->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->req = req;
+    __atomic_add_fetch (&e->stats.depth, 1, __ATOMIC_RELAXED);
+    __atomic_store_n (&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static blabla_request *engine_pop (blabla_engine *e)
+{
+    uint64_t pos = __atomic_load_n (&e->head, __ATOMIC_RELAXED);
+    engine_cell *cell;
+    blabla_request *req;
+
+    for (;;)
+    {
+        int64_t diff;
+
+        cell = &e->cells[pos & e->mask];
+        diff = (int64_t)(__atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n (&e->head, &pos, pos + 1, 1,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return NULL; /* empty */
+        }
+        else
+        {
+            pos = __atomic_load_n (&e->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    req = cell->req;
+    __atomic_store_n (&cell->seq, pos + e->mask + 1, __ATOMIC_RELEASE);
+    __atomic_sub_fetch (&e->stats.depth, 1, __ATOMIC_RELAXED);
+    return req;
+}
+
+static void engine_complete (blabla_engine *e, blabla_request *req)
+{
+    uint64_t lat = engine_now () - req->submitted;
+    int bucket = 0;
+
+    while (bucket < BLABLA_ENGINE_BUCKETS - 1 && (lat >> bucket) > 1)
+        ++bucket;
+    __atomic_add_fetch (&e->stats.latency[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&e->stats.latency_sum, lat, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&e->stats.completed, 1, __ATOMIC_RELAXED);
+
+    /* The request may be freed or reused as soon as it is handed back */
+    if (req->done != NULL)
+    {
+        req->done (req);
+    }
+    else
+    {
+        int fd = req->fd;
+
+        __atomic_store_n (&req->status, 1, __ATOMIC_RELEASE);
+        if (fd >= 0)
+        {
+            uint64_t one = 1;
+
+            if (write (fd, &one, sizeof (one)) < 0)
+                __atomic_add_fetch (&e->stats.notify_errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Chunks of a large request, until none is left */
+static void engine_run_chunks (blabla_engine *e, blabla_request *req)
+{
+    uint64_t i;
+
+    while ((i = __atomic_fetch_add (&req->next, 1, __ATOMIC_RELAXED)) < req->nchunks)
+    {
+        uint64_t off = i * ENGINE_CHUNK;
+        uint64_t len = req->job.len - off < ENGINE_CHUNK ? req->job.len - off : ENGINE_CHUNK;
+        blabla_ctxt ctxt;
+
+        blabla_ctxt_init (&ctxt, req->job.key, req->job.nonce);
+        ctxt.counter[1] += off / BLOCK_LEN;
+        blabla_ctxt_xor (&ctxt, req->job.in + off, req->job.out + off, len);
+    }
+
+    if (__atomic_sub_fetch (&req->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        engine_complete (e, req);
+}
+
+/* req and the small requests queued right behind it, in the SIMD lanes.
+ * Returns the first request that did not fit in the batch, if any. */
+static blabla_request *engine_run_batch (blabla_engine *e, blabla_request *req)
+{
+    blabla_request *reqs[ENGINE_BATCH_MAX];
+    blabla_job jobs[ENGINE_BATCH_MAX];
+    blabla_request *next = NULL;
+    int count = 0, i;
+
+    reqs[count++] = req;
+    while (count < ENGINE_BATCH_MAX && (next = engine_pop (e)) != NULL)
+    {
+        if (next->nchunks != 0 || next->job.len > ENGINE_BATCH_LEN)
+            break;
+        reqs[count++] = next;
+        next = NULL;
+    }
+
+    for (i = 0; i < count; ++i)
+        jobs[i] = reqs[i]->job;
+    if (count == 1)
+        blabla_xor (jobs[0].out, jobs[0].in, jobs[0].len, jobs[0].nonce, jobs[0].key);
+    else
+        blabla_xor_batch (jobs, count);
+    __atomic_add_fetch (&e->stats.batches, 1, __ATOMIC_RELAXED);
+
+    for (i = 0; i < count; ++i)
+        engine_complete (e, reqs[i]);
+    return next;
+}
+
+static void *engine_worker (void *arg)
+{
+    blabla_engine *e = arg;
+    blabla_request *req = NULL;
+    int spins = 0;
+
+    for (;;)
+    {
+        if (req == NULL)
+            req = engine_pop (e);
+
+        if (req != NULL)
+        {
+            spins = 0;
+            if (req->nchunks != 0)
+            {
+                engine_run_chunks (e, req);
+                req = NULL;
+            }
+            else if (req->job.len <= ENGINE_BATCH_LEN)
+            {
+                req = engine_run_batch (e, req);
+            }
+            else
+            {
+                blabla_xor (req->job.out, req->job.in, req->job.len, req->job.nonce, req->job.key);
+                __atomic_add_fetch (&e->stats.batches, 1, __ATOMIC_RELAXED);
+                engine_complete (e, req);
+                req = NULL;
+            }
+            continue;
+        }
+
+        if (++spins < ENGINE_SPINS)
+            continue;
+
+        /* Sleep until engine_submit sees idle > 0 and signals. The queue is
+         * checked again after idle is published, so that a request pushed in
+         * between is not missed. */
+        pthread_mutex_lock (&e->lock);
+        __atomic_add_fetch (&e->idle, 1, __ATOMIC_SEQ_CST);
+        while ((req = engine_pop (e)) == NULL && !e->stop)
+            pthread_cond_wait (&e->wake, &e->lock);
+        __atomic_sub_fetch (&e->idle, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock (&e->lock);
+        spins = 0;
+
+        if (req == NULL)
+            break; /* stopped with an empty queue */
+    }
+    return NULL;
+}
+
+blabla_engine *blabla_engine_create (int nworkers, uint64_t depth)
+{
+    blabla_engine *e;
+    uint64_t size = 2, i;
+
+    if (nworkers <= 0)
+        nworkers = (int)sysconf (_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1)
+        nworkers = 1;
+    if (nworkers > ENGINE_MAX_WORKERS)
+        nworkers = ENGINE_MAX_WORKERS;
+    while (size < depth)
+        size <<= 1;
+
+    if (posix_memalign ((void **)&e, 64, sizeof (*e)) != 0)
+        return NULL;
+    memset (e, 0, sizeof (*e));
+    e->cells = malloc (size * sizeof (engine_cell));
+    if (e->cells == NULL)
+    {
+        free (e);
+        return NULL;
+    }
+    for (i = 0; i < size; ++i)
+        e->cells[i].seq = i;
+    e->mask = size - 1;
+    pthread_mutex_init (&e->lock, NULL);
+    pthread_cond_init (&e->wake, NULL);
+
+    while (e->nworkers < nworkers)
+    {
+        if (pthread_create (&e->workers[e->nworkers], NULL, engine_worker, e) != 0)
+            break;
+        ++e->nworkers;
+    }
+    if (e->nworkers == 0)
+    {
+        blabla_engine_destroy (e);
+        return NULL;
+    }
+    return e;
+}
+
+void blabla_engine_destroy (blabla_engine *e)
+{
+    int i;
+
+    pthread_mutex_lock (&e->lock);
+    e->stop = 1;
+    pthread_cond_broadcast (&e->wake);
+    pthread_mutex_unlock (&e->lock);
+
+    for (i = 0; i < e->nworkers; ++i)
+        pthread_join (e->workers[i], NULL);
+
+    pthread_cond_destroy (&e->wake);
+    pthread_mutex_destroy (&e->lock);
+    free (e->cells);
+    free (e);
+}
+
+int blabla_engine_submit (blabla_engine *e, blabla_request *req)
+{
+    uint64_t nchunks = 0;
+    int copies = 1, pushed = 0;
+
+    if (req->job.len > ENGINE_SPLIT_LEN && e->nworkers > 1)
+    {
+        nchunks = (req->job.len + ENGINE_CHUNK - 1) / ENGINE_CHUNK;
+        copies = nchunks < (uint64_t)e->nworkers ? (int)nchunks : e->nworkers;
+    }
+    req->status = 0;
+    req->submitted = engine_now ();
+    req->next = 0;
+    req->nchunks = nchunks;
+    /* One reference per copy of a split request in the queue, plus ours
+     * until they are all in. A request that is not split has a single copy
+     * and may be complete as soon as it is pushed, so it is not touched
+     * again after that. */
+    if (nchunks != 0)
+        req->refs = copies + 1;
+
+    while (pushed < copies && engine_push (e, req) == 0)
+        ++pushed;
+    if (pushed == 0)
+    {
+        __atomic_add_fetch (&e->stats.rejected, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    __atomic_add_fetch (&e->stats.submitted, 1, __ATOMIC_RELAXED);
+
+    /* Wake sleeping workers (see engine_worker). Reading idle with an RMW
+     * orders it with their increment: either they see our push, or we see
+     * them idle. */
+    if (__atomic_fetch_add (&e->idle, 0, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock (&e->lock);
+        if (pushed > 1)
+            pthread_cond_broadcast (&e->wake);
+        else
+            pthread_cond_signal (&e->wake);
+        pthread_mutex_unlock (&e->lock);
+    }
+
+    /* Copies that did not fit, and our own reference */
+    if (nchunks != 0
+        && __atomic_sub_fetch (&req->refs, copies - pushed + 1, __ATOMIC_ACQ_REL) == 0)
+        engine_complete (e, req);
+    return 0;
+}
+
+int blabla_request_done (const blabla_request *req)
+{
+    return __atomic_load_n (&req->status, __ATOMIC_ACQUIRE);
+}
+
+void blabla_engine_get_stats (blabla_engine *e, blabla_engine_stats *stats)
+{
+    int i;
+
+    stats->submitted = __atomic_load_n (&e->stats.submitted, __ATOMIC_RELAXED);
+    stats->completed = __atomic_load_n (&e->stats.completed, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n (&e->stats.rejected, __ATOMIC_RELAXED);
+    stats->batches = __atomic_load_n (&e->stats.batches, __ATOMIC_RELAXED);
+    stats->depth = __atomic_load_n (&e->stats.depth, __ATOMIC_RELAXED);
+    stats->notify_errors = __atomic_load_n (&e->stats.notify_errors, __ATOMIC_RELAXED);
+    stats->latency_sum = __atomic_load_n (&e->stats.latency_sum, __ATOMIC_RELAXED);
+    for (i = 0; i < BLABLA_ENGINE_BUCKETS; ++i)
+        stats->latency[i] = __atomic_load_n (&e->stats.latency[i], __ATOMIC_RELAXED);
+}
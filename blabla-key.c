@@ -0,0 +1,31 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+#include "blabla.h"
+#include "util.h"
+
+
+void blabla_key_init (blabla_key *key, const uint8_t *k)
+{
+    uint64_t words[13];
+    int i, j;
+
+    memcpy (key->key, k, 32);
+    memcpy (words, constants, 32);
+    memcpy (words + 4, k, 32);
+    memcpy (words + 8, constants + 4, 32);
+    words[12] = constants[8];
+
+    for (i = 0; i < 13; ++i)
+        for (j = 0; j < BLABLA_KEY_LANES; ++j)
+            key->lanes[i][j] = words[i];
+    blabla_wipe (words, sizeof (words));
+}
+
+void blabla_key_wipe (blabla_key *key)
+{
+    blabla_wipe (key, sizeof (*key));
+}
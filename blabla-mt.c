@@ -0,0 +1,165 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+/*
+ * Multi-threaded blabla_xor: every block only depends on the key, the nonce
+ * and its counter, so the buffer is cut into counter-aligned chunks that a
+ * persistent pool of worker threads (plus the caller) process independently.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "blabla.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#define MT_MAX_THREADS 64
+/* Below this, waking up workers costs more than it saves */
+#define MT_MIN_LEN (1 << 20)
+/* Chunks are a whole number of cores for every backend */
+#define MT_MIN_CHUNK (64 * BLABLA_STREAM_BUFLEN)
+
+typedef struct
+{
+    blabla_ctxt ctxt;
+    const uint8_t *in;
+    uint8_t *out;
+    uint64_t len;
+    uint64_t chunk;
+    uint64_t nchunks;
+    uint64_t next; /* next chunk to process, shared by all threads */
+} mt_job;
+
+static struct
+{
+    pthread_mutex_t busy; /* one job at a time */
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    int nworkers;
+    int slots;   /* workers that may still join the current job */
+    int running; /* workers that joined it and have not returned yet */
+    uint64_t generation;
+    mt_job *job;
+} pool = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+};
+
+
+static void mt_run (mt_job *job)
+{
+    uint64_t i;
+
+    while ((i = __atomic_fetch_add (&job->next, 1, __ATOMIC_RELAXED)) < job->nchunks)
+    {
+        uint64_t off = i * job->chunk;
+        uint64_t len = job->len - off < job->chunk ? job->len - off : job->chunk;
+        blabla_ctxt ctxt = job->ctxt;
+
+        ctxt.counter[1] += off / BLOCK_LEN;
+        blabla_ctxt_xor (&ctxt, job->in + off, job->out + off, len);
+    }
+}
+
+static void *mt_worker (void *arg)
+{
+    uint64_t seen = 0;
+
+    (void)arg;
+    pthread_mutex_lock (&pool.lock);
+    for (;;)
+    {
+        mt_job *job;
+
+        while (pool.job == NULL || pool.generation == seen || pool.slots == 0)
+        {
+            if (pool.job == NULL || pool.slots == 0)
+                seen = pool.generation;
+            pthread_cond_wait (&pool.start, &pool.lock);
+        }
+        seen = pool.generation;
+        job = pool.job;
+        --pool.slots;
+        ++pool.running;
+        pthread_mutex_unlock (&pool.lock);
+
+        mt_run (job);
+
+        pthread_mutex_lock (&pool.lock);
+        if (--pool.running == 0)
+            pthread_cond_signal (&pool.done);
+    }
+    return NULL;
+}
+
+/* Called with pool.lock held */
+static void mt_spawn (int nworkers)
+{
+    pthread_attr_t attr;
+
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+    while (pool.nworkers < nworkers)
+    {
+        pthread_t thread;
+
+        if (pthread_create (&thread, &attr, mt_worker, NULL) != 0)
+            break;
+        ++pool.nworkers;
+    }
+    pthread_attr_destroy (&attr);
+}
+
+int blabla_xor_mt (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k, int nthreads)
+{
+    mt_job job;
+
+    if (nthreads <= 0)
+        nthreads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+    if (nthreads > MT_MAX_THREADS)
+        nthreads = MT_MAX_THREADS;
+    if (nthreads <= 1 || inlen < MT_MIN_LEN)
+        return blabla_xor (out, in, inlen, n, k);
+
+    blabla_ctxt_init (&job.ctxt, k, n);
+    job.in = in;
+    job.out = out;
+    job.len = inlen;
+    /* A few chunks per thread to even out the load */
+    job.chunk = inlen / (4 * (uint64_t)nthreads);
+    job.chunk -= job.chunk % MT_MIN_CHUNK;
+    if (job.chunk < MT_MIN_CHUNK)
+        job.chunk = MT_MIN_CHUNK;
+    job.nchunks = (inlen + job.chunk - 1) / job.chunk;
+    job.next = 0;
+
+    pthread_mutex_lock (&pool.busy);
+
+    pthread_mutex_lock (&pool.lock);
+    mt_spawn (nthreads - 1);
+    pool.job = &job;
+    pool.slots = nthreads - 1;
+    ++pool.generation;
+    pthread_cond_broadcast (&pool.start);
+    pthread_mutex_unlock (&pool.lock);
+
+    mt_run (&job);
+
+    /* Every chunk has been taken: stop new workers from joining and wait for
+     * the ones still working */
+    pthread_mutex_lock (&pool.lock);
+    pool.job = NULL;
+    pool.slots = 0;
+    while (pool.running > 0)
+        pthread_cond_wait (&pool.done, &pool.lock);
+    pthread_mutex_unlock (&pool.lock);
+
+    pthread_mutex_unlock (&pool.busy);
+    return 0;
+}
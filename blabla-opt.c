@@ -8,17 +8,19 @@
 #include "crypto_stream.h"
 #endif
 
-#include "blabla.h"
 #include "config.h"
+#include "blabla.h"
+#include "poly1305.h"
+#include "stats.h"
+#ifndef BLABLA_GENERIC
 /* Intel intrinsics */
 #include <immintrin.h>
+#endif
 
-typedef struct
+const char *blabla_backend_name (void)
 {
-    uint64_t key[4];
-    uint64_t counter[4];
-} blabla_ctxt;
-
+    return BLABLA_ISA;
+}
 
 void blabla_ctxt_init (blabla_ctxt *ctxt, const uint8_t *key, const uint8_t *nonce)
 {
@@ -37,17 +39,146 @@ void blabla_ctxt_init_zero (blabla_ctxt *ctxt, const uint8_t *key)
 }
 
 
-#ifdef HAVE_AVX2
+#if defined(BLABLA_GENERIC)
+
+/*
+ * Portable backend on GCC/Clang vector extensions, for non-x86 hosts and
+ * builds without SIMD: the compiler maps the 2-lane vectors to whatever the
+ * target has (NEON, SSE2, or pairs of general-purpose registers).
+ */
+typedef uint64_t blabla_v2u64 __attribute__ ((vector_size (16)));
+typedef double blabla_v2f64 __attribute__ ((vector_size (16)));
+
+static inline blabla_v2u64 generic_loadu (const void *m)
+{
+    blabla_v2u64 v;
+
+    memcpy (&v, m, sizeof (v));
+    return v;
+}
+
+static inline void generic_storeu (void *m, blabla_v2u64 v)
+{
+    memcpy (m, &v, sizeof (v));
+}
+
+#define BLOCKS_PER_CORE 2
+#define MM_TYPE        blabla_v2u64
+#define MM_BITS        128
+#define LOADU(m)       generic_loadu ((const void *)(m))
+#define STOREU(m, v)   generic_storeu ((void *)(m), (v))
+#define LOADA(m)       (*(const MM_TYPE *)(m))
+#define STREAM(m, v)   STOREU (m, v)
+#define STREAM_FENCE() do { } while (0)
+#define SET1_EPI64x(v) ((MM_TYPE){ (uint64_t)(v), (uint64_t)(v) })
+#define SET_EPI64x2(hi, lo) ((MM_TYPE){ (uint64_t)(lo), (uint64_t)(hi) })
+#define INIT_COUNTER   SET_EPI64x2 (1, 0)
+
+#define ADD(A, B) ((A) + (B))
+#define XOR(A, B) ((A) ^ (B))
+#define UNIT_DOUBLE(v)                                                         \
+    ((MM_TYPE)((blabla_v2f64)(((v) >> 12) | SET1_EPI64x (0x3ff0000000000000ULL)) - 1.0))
+
+#define AND(A, B)      ((A) & (B))
+#define OR(A, B)       ((A) | (B))
+#define SHR64(X, N)    ((X) >> (N))
+#define SHL64(X, N)    ((X) << (N))
+#define MUL32(A, B)    (AND (A, SET1_EPI64x (0xffffffff)) * AND (B, SET1_EPI64x (0xffffffff)))
+#define UNPACKLO64(A, B) ((MM_TYPE){ (A)[0], (B)[0] })
+#define UNPACKHI64(A, B) ((MM_TYPE){ (A)[1], (B)[1] })
+#define POLY_LOAD(p, lo, hi)                                                   \
+    do                                                                         \
+    {                                                                          \
+        MM_TYPE a_ = LOADU (p), b_ = LOADU ((p) + 16);                         \
+        lo = UNPACKLO64 (a_, b_);                                              \
+        hi = UNPACKHI64 (a_, b_);                                              \
+    } while (0)
+
+/* Swapping the 32-bit halves is a single shuffle where the target has one */
+typedef uint32_t blabla_v4u32 __attribute__ ((vector_size (16)));
+#if defined(__clang__)
+#define ROT32(X)                                                               \
+    ((MM_TYPE)__builtin_shufflevector ((blabla_v4u32)(X), (blabla_v4u32)(X), 1, 0, 3, 2))
+#else
+#define ROT32(X) ((MM_TYPE)__builtin_shuffle ((blabla_v4u32)(X), (blabla_v4u32){ 1, 0, 3, 2 }))
+#endif
+
+#define ROT(X, R) ((R) == 32 ? ROT32 (X) : (((X) >> (R)) | ((X) << (64 - (R)))))
+
+#elif defined(HAVE_AVX512F)
+
+#define BLOCKS_PER_CORE 8
+#define MM_TYPE        __m512i
+#define MM_BITS        512
+#define LOADU(m)       _mm512_loadu_si512 ((const void *)(m))
+#define STOREU(m, v)   _mm512_storeu_si512 ((void *)(m), (v))
+#define LOADA(m)       _mm512_load_si512 ((const void *)(m))
+#define STREAM(m, v)   _mm512_stream_si512 ((void *)(m), (v))
+#define STREAM_FENCE() _mm_sfence ()
+#define SET1_EPI64x(v) _mm512_set1_epi64 (v)
+#define INIT_COUNTER   _mm512_set_epi64 (7, 6, 5, 4, 3, 2, 1, 0)
+
+#define ADD(A, B) _mm512_add_epi64 (A, B)
+#define XOR(A, B) _mm512_xor_si512 (A, B)
+/* Bits 12-63 as the mantissa of a double in [1, 2), minus 1 */
+#define UNIT_DOUBLE(v)                                                         \
+    _mm512_castpd_si512 (_mm512_sub_pd (                                       \
+        _mm512_castsi512_pd (_mm512_or_si512 (_mm512_srli_epi64 (v, 12),       \
+                                              _mm512_set1_epi64 (0x3ff0000000000000LL))), \
+        _mm512_set1_pd (1.0)))
+
+/* For Poly1305: 32x32-bit products, and POLY_LOAD puts the low and high
+ * halves of 16-byte block j of p into lane j of lo and hi */
+#define AND(A, B)      _mm512_and_si512 (A, B)
+#define OR(A, B)       _mm512_or_si512 (A, B)
+#define SHR64(X, N)    _mm512_srli_epi64 (X, N)
+#define SHL64(X, N)    _mm512_slli_epi64 (X, N)
+#define MUL32(A, B)    _mm512_mul_epu32 (A, B)
+#define POLY_LOAD(p, lo, hi)                                                   \
+    do                                                                         \
+    {                                                                          \
+        __m512i a_ = LOADU (p), b_ = LOADU ((p) + 64);                         \
+        lo = _mm512_permutex2var_epi64 (a_, _mm512_set_epi64 (14, 12, 10, 8, 6, 4, 2, 0), b_); \
+        hi = _mm512_permutex2var_epi64 (a_, _mm512_set_epi64 (15, 13, 11, 9, 7, 5, 3, 1), b_); \
+    } while (0)
+
+/* vprorq handles all four rotation amounts */
+#define ROT(X, R) _mm512_ror_epi64 ((X), (R))
+
+#elif defined(HAVE_AVX2)
 
 #define BLOCKS_PER_CORE 4
 #define MM_TYPE        __m256i
+#define MM_BITS        256
 #define LOADU(m)       _mm256_loadu_si256 ((const __m256i *)(m))
 #define STOREU(m, v)   _mm256_storeu_si256 ((__m256i *)(m), (v))
+#define LOADA(m)       _mm256_load_si256 ((const __m256i *)(m))
+#define STREAM(m, v)   _mm256_stream_si256 ((__m256i *)(m), (v))
+#define STREAM_FENCE() _mm_sfence ()
 #define SET1_EPI64x(v) _mm256_set1_epi64x (v)
 #define INIT_COUNTER   _mm256_set_epi64x (3, 2, 1, 0)
 
 #define ADD(A, B) _mm256_add_epi64 (A, B)
 #define XOR(A, B) _mm256_xor_si256 (A, B)
+#define UNIT_DOUBLE(v)                                                         \
+    _mm256_castpd_si256 (_mm256_sub_pd (                                       \
+        _mm256_castsi256_pd (_mm256_or_si256 (_mm256_srli_epi64 (v, 12),       \
+                                              _mm256_set1_epi64x (0x3ff0000000000000LL))), \
+        _mm256_set1_pd (1.0)))
+
+#define AND(A, B)      _mm256_and_si256 (A, B)
+#define OR(A, B)       _mm256_or_si256 (A, B)
+#define SHR64(X, N)    _mm256_srli_epi64 (X, N)
+#define SHL64(X, N)    _mm256_slli_epi64 (X, N)
+#define MUL32(A, B)    _mm256_mul_epu32 (A, B)
+/* Blocks 0, 2, 1, 3 after the unpacks, hence the permutation */
+#define POLY_LOAD(p, lo, hi)                                                   \
+    do                                                                         \
+    {                                                                          \
+        __m256i a_ = LOADU (p), b_ = LOADU ((p) + 32);                         \
+        lo = _mm256_permute4x64_epi64 (_mm256_unpacklo_epi64 (a_, b_), _MM_SHUFFLE (3, 1, 2, 0)); \
+        hi = _mm256_permute4x64_epi64 (_mm256_unpackhi_epi64 (a_, b_), _MM_SHUFFLE (3, 1, 2, 0)); \
+    } while (0)
 
 #define ROT16                                                                  \
     _mm256_setr_epi8 (2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,    \
@@ -57,6 +188,12 @@ void blabla_ctxt_init_zero (blabla_ctxt *ctxt, const uint8_t *key)
     _mm256_setr_epi8 (3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,    \
                       3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10)
 
+#ifdef HAVE_AVX512VL
+
+#define ROT(X, R) _mm256_ror_epi64 ((X), (R))
+
+#else /* !HAVE_AVX512VL */
+
 #define ROT(X, R)                                                              \
     (R) == 32 ? _mm256_shuffle_epi32 ((X), _MM_SHUFFLE (2, 3, 0, 1))           \
   : (R) == 24 ? _mm256_shuffle_epi8  ((X), ROT24)                              \
@@ -64,17 +201,44 @@ void blabla_ctxt_init_zero (blabla_ctxt *ctxt, const uint8_t *key)
   :             XOR (_mm256_srli_epi64 ((X), (R)),                             \
                      _mm256_slli_epi64 ((X), 64 - (R)))
 
+#endif /* HAVE_AVX512VL */
+
 #else /* !HAVE_AVX2 */
 
 #define BLOCKS_PER_CORE 2
 #define MM_TYPE        __m128i
+#define MM_BITS        128
 #define LOADU(m)       _mm_loadu_si128 ((const __m128i *)(m))
 #define STOREU(m, v)   _mm_storeu_si128 ((__m128i *)(m), (v))
+#define LOADA(m)       _mm_load_si128 ((const __m128i *)(m))
+#define STREAM(m, v)   _mm_stream_si128 ((__m128i *)(m), (v))
+#define STREAM_FENCE() _mm_sfence ()
 #define SET1_EPI64x(v) _mm_set1_epi64x (v)
+#define SET_EPI64x2(hi, lo) _mm_set_epi64x (hi, lo)
 #define INIT_COUNTER   _mm_set_epi64x (1, 0)
 
 #define ADD(A, B) _mm_add_epi64 (A, B)
 #define XOR(A, B) _mm_xor_si128 (A, B)
+#define UNIT_DOUBLE(v)                                                         \
+    _mm_castpd_si128 (_mm_sub_pd (                                             \
+        _mm_castsi128_pd (_mm_or_si128 (_mm_srli_epi64 (v, 12),                \
+                                        _mm_set1_epi64x (0x3ff0000000000000LL))), \
+        _mm_set1_pd (1.0)))
+
+#define AND(A, B)      _mm_and_si128 (A, B)
+#define OR(A, B)       _mm_or_si128 (A, B)
+#define SHR64(X, N)    _mm_srli_epi64 (X, N)
+#define SHL64(X, N)    _mm_slli_epi64 (X, N)
+#define MUL32(A, B)    _mm_mul_epu32 (A, B)
+#define UNPACKLO64(A, B) _mm_unpacklo_epi64 (A, B)
+#define UNPACKHI64(A, B) _mm_unpackhi_epi64 (A, B)
+#define POLY_LOAD(p, lo, hi)                                                   \
+    do                                                                         \
+    {                                                                          \
+        __m128i a_ = LOADU (p), b_ = LOADU ((p) + 16);                         \
+        lo = UNPACKLO64 (a_, b_);                                              \
+        hi = UNPACKHI64 (a_, b_);                                              \
+    } while (0)
 
 
 #ifdef HAVE_SSSE3
@@ -101,7 +265,50 @@ void blabla_ctxt_init_zero (blabla_ctxt *ctxt, const uint8_t *key)
 
 #endif /* HAVE_SSSE3 */
 
-#endif /* HAVE_AVX2 */
+#endif /* BLABLA_GENERIC */
+
+
+/* One more block in general-purpose registers next to each core in the
+ * keystream and xor loops (see BLABLA_CORE_H), instead of interleaved cores:
+ * measured 5-20% faster than those with 128-bit vectors, where the scalar
+ * ALUs keep up with a 2-block core, and slower with wider ones.
+ * -DHYBRID_CORES or -DNO_HYBRID_CORES overrides this. */
+#if !defined(HYBRID_CORES) && !defined(NO_HYBRID_CORES)
+#if !defined(HAVE_AVX2)
+#define HYBRID_CORES
+#endif
+#endif
+
+/* Two interleaved cores per iteration in the bulk loops (see BLABLA_CORE2):
+ * measured faster with SSE2-only rotations and with the 32 registers of
+ * AVX-512VL, slower or equal elsewhere. With HYBRID_CORES, only the loops
+ * without a hybrid version (AEAD, PRNG) use them. -DINTERLEAVE_CORES or
+ * -DNO_INTERLEAVE_CORES overrides this. */
+#if !defined(INTERLEAVE_CORES) && !defined(NO_INTERLEAVE_CORES)
+#if !defined(HAVE_SSSE3) || (defined(HAVE_AVX512VL) && !defined(HAVE_AVX512F))
+#define INTERLEAVE_CORES
+#endif
+#endif
+
+/* G function, for any vector type given its add, xor and rotation */
+#define G(A, B, C, D, ADD_, XOR_, ROT_)                                        \
+    do                                                                         \
+    {                                                                          \
+        A = ADD_ (A, B);                                                       \
+        D = XOR_ (D, A);                                                       \
+        D = ROT_ (D, 32);                                                      \
+        C = ADD_ (C, D);                                                       \
+        B = XOR_ (B, C);                                                       \
+        B = ROT_ (B, 24);                                                      \
+        A = ADD_ (A, B);                                                       \
+        D = XOR_ (D, A);                                                       \
+        D = ROT_ (D, 16);                                                      \
+        C = ADD_ (C, D);                                                       \
+        B = XOR_ (B, C);                                                       \
+        B = ROT_ (B, 63);                                                      \
+    } while (0)
+
+#define QUARTER_ROUND(A, B, C, D) G (A, B, C, D, ADD, XOR, ROT)
 
 
 #ifdef MANUAL_SCHEDULING /* This is slower in practice */
@@ -154,23 +361,6 @@ x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, R1, R2)  \
 
 #else /* !MANUAL_SCHEDULING */
 
-#define QUARTER_ROUND(A, B, C, D)                                              \
-    do                                                                         \
-    {                                                                          \
-        A = ADD (A, B);                                                        \
-        D = XOR (D, A);                                                        \
-        D = ROT (D, 32);                                                       \
-        C = ADD (C, D);                                                        \
-        B = XOR (B, C);                                                        \
-        B = ROT (B, 24);                                                       \
-        A = ADD (A, B);                                                        \
-        D = XOR (D, A);                                                        \
-        D = ROT (D, 16);                                                       \
-        C = ADD (C, D);                                                        \
-        B = XOR (B, C);                                                        \
-        B = ROT (B, 63);                                                       \
-    } while (0)
-
 #define DOUBLE_ROUND(x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15) \
     do                                                                                     \
     {                                                                                      \
@@ -191,14 +381,14 @@ x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, R1, R2)  \
 #define BLABLA_CORE(z0, z1, z2, z3, z4, z5, z6, z7,                                              \
                     z8, z9,z10,z11,z12,z13,z14,z15,                                              \
                     x0, x1, x2, x3, x4, x5, x6, x7,                                              \
-                    x8, x9,x10,x11,x12,x13,x14,x15)                                              \
+                    x8, x9,x10,x11,x12,x13,x14,x15, rounds)                                      \
     do                                                                                           \
     {                                                                                            \
         int i;                                                                                   \
         z0 = x0, z1 = x1, z2 = x2, z3 = x3, z4 = x4, z5 = x5, z6 = x6,                           \
         z7 = x7, z8 = x8, z9 = x9, z10 = x10, z11 = x11, z12 = x12, z13 = x13,                   \
         z14 = x14, z15 = x15;                                                                    \
-        for (i = 0; i < nROUNDS; ++i)                                                            \
+        for (i = 0; i < (rounds); ++i)                                                           \
             DOUBLE_ROUND (z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15); \
                                                                                                  \
         z0 = ADD (x0, z0);                                                                       \
@@ -220,7 +410,352 @@ x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, R1, R2)  \
     } while (0)
 
 
-#ifdef HAVE_AVX2
+/*
+ * In the first column round, only the quarter-round on (x1, x5, x9, x13)
+ * depends on the block counter. The other three columns, and the first steps
+ * of the diagonal quarter-rounds on (x2, x7, x8, x13) and (x3, x4, x9, x14),
+ * are the same for every block of a message: BLABLA_PRECOMPUTE computes them
+ * once from x into p, and BLABLA_CORE_P finishes the first double round from
+ * there. p1, p5, p9 and p13 are not used.
+ */
+#define BLABLA_PRECOMPUTE()                                                    \
+    do                                                                         \
+    {                                                                          \
+        p0 = x0, p4 = x4, p8 = x8, p12 = x12;                                  \
+        p2 = x2, p6 = x6, p10 = x10, p14 = x14;                                \
+        p3 = x3, p7 = x7, p11 = x11, p15 = x15;                                \
+        QUARTER_ROUND (p0, p4, p8, p12);                                       \
+        QUARTER_ROUND (p2, p6, p10, p14);                                      \
+        QUARTER_ROUND (p3, p7, p11, p15);                                      \
+        /* A = A + B of (x2, x7, x8, x13), and (x3, x4, x9, x14) up to D */    \
+        p2 = ADD (p2, p7);                                                     \
+        p3 = ADD (p3, p4);                                                     \
+        p14 = ROT (XOR (p14, p3), 32);                                         \
+    } while (0)
+
+/* The rest of G after A = A + B, and after D = ROT (D ^ A, 32) as well */
+#define G_FROM_D(A, B, C, D)                                                   \
+    do                                                                         \
+    {                                                                          \
+        D = XOR (D, A);                                                        \
+        D = ROT (D, 32);                                                       \
+        G_FROM_C (A, B, C, D);                                                 \
+    } while (0)
+
+#define G_FROM_C(A, B, C, D)                                                   \
+    do                                                                         \
+    {                                                                          \
+        C = ADD (C, D);                                                        \
+        B = XOR (B, C);                                                        \
+        B = ROT (B, 24);                                                       \
+        A = ADD (A, B);                                                        \
+        D = XOR (D, A);                                                        \
+        D = ROT (D, 16);                                                       \
+        C = ADD (C, D);                                                        \
+        B = XOR (B, C);                                                        \
+        B = ROT (B, 63);                                                       \
+    } while (0)
+
+/* First double round of a state z from p, x1, x5, x9 and x13 = ctr */
+#define FIRST_DOUBLE_ROUND_P(z0, z1, z2, z3, z4, z5, z6, z7,                   \
+                             z8, z9,z10,z11,z12,z13,z14,z15, ctr)              \
+    do                                                                         \
+    {                                                                          \
+        z1 = x1, z5 = x5, z9 = x9, z13 = ctr;                                  \
+        QUARTER_ROUND (z1, z5, z9, z13);                                       \
+        z0 = p0, z2 = p2, z3 = p3, z4 = p4, z6 = p6, z7 = p7;                  \
+        z8 = p8, z10 = p10, z11 = p11, z12 = p12, z14 = p14, z15 = p15;        \
+        QUARTER_ROUND (z0, z5, z10, z15);                                      \
+        QUARTER_ROUND (z1, z6, z11, z12);                                      \
+        G_FROM_D (z2, z7, z8, z13);                                            \
+        G_FROM_C (z3, z4, z9, z14);                                            \
+    } while (0)
+
+#define BLABLA_FEED_FORWARD(z0, z1, z2, z3, z4, z5, z6, z7,                    \
+                            z8, z9,z10,z11,z12,z13,z14,z15, ctr)               \
+    do                                                                         \
+    {                                                                          \
+        z0 = ADD (x0, z0), z1 = ADD (x1, z1), z2 = ADD (x2, z2);               \
+        z3 = ADD (x3, z3), z4 = ADD (x4, z4), z5 = ADD (x5, z5);               \
+        z6 = ADD (x6, z6), z7 = ADD (x7, z7), z8 = ADD (x8, z8);               \
+        z9 = ADD (x9, z9), z10 = ADD (x10, z10), z11 = ADD (x11, z11);         \
+        z12 = ADD (x12, z12), z13 = ADD (ctr, z13), z14 = ADD (x14, z14);      \
+        z15 = ADD (x15, z15);                                                  \
+    } while (0)
+
+/* Same as BLABLA_CORE on x into z, given BLABLA_PRECOMPUTE */
+#define BLABLA_CORE_P(rounds)                                                                    \
+    do                                                                                           \
+    {                                                                                            \
+        int i;                                                                                   \
+        FIRST_DOUBLE_ROUND_P (z0, z1, z2, z3, z4, z5, z6, z7,                                    \
+                              z8, z9,z10,z11,z12,z13,z14,z15, x13);                              \
+        for (i = 1; i < (rounds); ++i)                                                           \
+            DOUBLE_ROUND (z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15); \
+        BLABLA_FEED_FORWARD (z0, z1, z2, z3, z4, z5, z6, z7,                                     \
+                             z8, z9,z10,z11,z12,z13,z14,z15, x13);                               \
+    } while (0)
+
+#ifdef INTERLEAVE_CORES
+
+/*
+ * Two independent cores per iteration, with the instructions of the second
+ * state y interleaved with those of z, for more independent work in flight.
+ * Uses x0..x15 as input (with counters x13 and x13 + BLOCKS_PER_CORE), and
+ * z0..z15, y0..y15 as output.
+ */
+#define G2(A, B, C, D, A2, B2, C2, D2)                                         \
+    do                                                                         \
+    {                                                                          \
+        A = ADD (A, B);                                                        \
+        A2 = ADD (A2, B2);                                                     \
+        D = XOR (D, A);                                                        \
+        D2 = XOR (D2, A2);                                                     \
+        D = ROT (D, 32);                                                       \
+        D2 = ROT (D2, 32);                                                     \
+        C = ADD (C, D);                                                        \
+        C2 = ADD (C2, D2);                                                     \
+        B = XOR (B, C);                                                        \
+        B2 = XOR (B2, C2);                                                     \
+        B = ROT (B, 24);                                                       \
+        B2 = ROT (B2, 24);                                                     \
+        A = ADD (A, B);                                                        \
+        A2 = ADD (A2, B2);                                                     \
+        D = XOR (D, A);                                                        \
+        D2 = XOR (D2, A2);                                                     \
+        D = ROT (D, 16);                                                       \
+        D2 = ROT (D2, 16);                                                     \
+        C = ADD (C, D);                                                        \
+        C2 = ADD (C2, D2);                                                     \
+        B = XOR (B, C);                                                        \
+        B2 = XOR (B2, C2);                                                     \
+        B = ROT (B, 63);                                                       \
+        B2 = ROT (B2, 63);                                                     \
+    } while (0)
+
+#define DOUBLE_ROUND2()                                                        \
+    do                                                                         \
+    {                                                                          \
+        G2 (z0, z4, z8, z12, y0, y4, y8, y12);                                 \
+        G2 (z1, z5, z9, z13, y1, y5, y9, y13);                                 \
+        G2 (z2, z6, z10, z14, y2, y6, y10, y14);                               \
+        G2 (z3, z7, z11, z15, y3, y7, y11, y15);                               \
+        G2 (z0, z5, z10, z15, y0, y5, y10, y15);                               \
+        G2 (z1, z6, z11, z12, y1, y6, y11, y12);                               \
+        G2 (z2, z7, z8, z13, y2, y7, y8, y13);                                 \
+        G2 (z3, z4, z9, z14, y3, y4, y9, y14);                                 \
+    } while (0)
+
+#define BLABLA_CORE2(rounds)                                                   \
+    do                                                                         \
+    {                                                                          \
+        int i;                                                                 \
+        MM_TYPE x13b = ADD (x13, SET1_EPI64x (BLOCKS_PER_CORE));               \
+        z0 = y0 = x0, z1 = y1 = x1, z2 = y2 = x2, z3 = y3 = x3;                \
+        z4 = y4 = x4, z5 = y5 = x5, z6 = y6 = x6, z7 = y7 = x7;                \
+        z8 = y8 = x8, z9 = y9 = x9, z10 = y10 = x10, z11 = y11 = x11;          \
+        z12 = y12 = x12, z13 = x13, y13 = x13b, z14 = y14 = x14;               \
+        z15 = y15 = x15;                                                       \
+        for (i = 0; i < (rounds); ++i)                                         \
+            DOUBLE_ROUND2 ();                                                  \
+                                                                               \
+        z0 = ADD (x0, z0), y0 = ADD (x0, y0);                                  \
+        z1 = ADD (x1, z1), y1 = ADD (x1, y1);                                  \
+        z2 = ADD (x2, z2), y2 = ADD (x2, y2);                                  \
+        z3 = ADD (x3, z3), y3 = ADD (x3, y3);                                  \
+        z4 = ADD (x4, z4), y4 = ADD (x4, y4);                                  \
+        z5 = ADD (x5, z5), y5 = ADD (x5, y5);                                  \
+        z6 = ADD (x6, z6), y6 = ADD (x6, y6);                                  \
+        z7 = ADD (x7, z7), y7 = ADD (x7, y7);                                  \
+        z8 = ADD (x8, z8), y8 = ADD (x8, y8);                                  \
+        z9 = ADD (x9, z9), y9 = ADD (x9, y9);                                  \
+        z10 = ADD (x10, z10), y10 = ADD (x10, y10);                            \
+        z11 = ADD (x11, z11), y11 = ADD (x11, y11);                            \
+        z12 = ADD (x12, z12), y12 = ADD (x12, y12);                            \
+        z13 = ADD (x13, z13), y13 = ADD (x13b, y13);                           \
+        z14 = ADD (x14, z14), y14 = ADD (x14, y14);                            \
+        z15 = ADD (x15, z15), y15 = ADD (x15, y15);                            \
+    } while (0)
+
+/* Moves the second core into z for BLABLA_OUT */
+#define BLABLA_NEXT_CORE()                                                     \
+    do                                                                         \
+    {                                                                          \
+        z0 = y0, z1 = y1, z2 = y2, z3 = y3, z4 = y4, z5 = y5, z6 = y6;         \
+        z7 = y7, z8 = y8, z9 = y9, z10 = y10, z11 = y11, z12 = y12;            \
+        z13 = y13, z14 = y14, z15 = y15;                                       \
+    } while (0)
+
+/* Same as BLABLA_CORE2, given BLABLA_PRECOMPUTE */
+#define BLABLA_CORE2_P(rounds)                                                 \
+    do                                                                         \
+    {                                                                          \
+        int i;                                                                 \
+        MM_TYPE x13b = ADD (x13, SET1_EPI64x (BLOCKS_PER_CORE));               \
+        FIRST_DOUBLE_ROUND_P (z0, z1, z2, z3, z4, z5, z6, z7,                  \
+                              z8, z9,z10,z11,z12,z13,z14,z15, x13);            \
+        FIRST_DOUBLE_ROUND_P (y0, y1, y2, y3, y4, y5, y6, y7,                  \
+                              y8, y9,y10,y11,y12,y13,y14,y15, x13b);           \
+        for (i = 1; i < (rounds); ++i)                                         \
+            DOUBLE_ROUND2 ();                                                  \
+        BLABLA_FEED_FORWARD (z0, z1, z2, z3, z4, z5, z6, z7,                   \
+                             z8, z9,z10,z11,z12,z13,z14,z15, x13);             \
+        BLABLA_FEED_FORWARD (y0, y1, y2, y3, y4, y5, y6, y7,                   \
+                             y8, y9,y10,y11,y12,y13,y14,y15, x13b);            \
+    } while (0)
+
+#endif /* INTERLEAVE_CORES */
+
+
+#ifdef HYBRID_CORES
+
+/*
+ * Hybrid cores: while the vector units run BLOCKS_PER_CORE blocks, the
+ * scalar ALUs run one more block in general-purpose registers (s0..s15),
+ * in the same round loop so that both streams are in flight together.
+ */
+#define SADD(A, B) ((A) + (B))
+#define SXOR(A, B) ((A) ^ (B))
+#define SROT(X, R) (((X) >> (R)) | ((X) << (64 - (R))))
+
+#define SCALAR_DOUBLE_ROUND()                                                  \
+    do                                                                         \
+    {                                                                          \
+        G (s0, s4, s8, s12, SADD, SXOR, SROT);                                 \
+        G (s1, s5, s9, s13, SADD, SXOR, SROT);                                 \
+        G (s2, s6, s10, s14, SADD, SXOR, SROT);                                \
+        G (s3, s7, s11, s15, SADD, SXOR, SROT);                                \
+        G (s0, s5, s10, s15, SADD, SXOR, SROT);                                \
+        G (s1, s6, s11, s12, SADD, SXOR, SROT);                                \
+        G (s2, s7, s8, s13, SADD, SXOR, SROT);                                 \
+        G (s3, s4, s9, s14, SADD, SXOR, SROT);                                 \
+    } while (0)
+
+/* Same as BLABLA_CORE_P, plus block ctr + BLOCKS_PER_CORE into s */
+#define BLABLA_CORE_H(rounds)                                                                    \
+    do                                                                                           \
+    {                                                                                            \
+        int i;                                                                                   \
+        s0 = constants[0], s1 = constants[1], s2 = constants[2], s3 = constants[3];              \
+        s4 = key[0], s5 = key[1], s6 = key[2], s7 = key[3];                                      \
+        s8 = constants[4], s9 = constants[5], s10 = constants[6], s11 = constants[7];            \
+        s12 = counter[0], s13 = ctr + BLOCKS_PER_CORE, s14 = counter[2], s15 = counter[3];       \
+        FIRST_DOUBLE_ROUND_P (z0, z1, z2, z3, z4, z5, z6, z7,                                    \
+                              z8, z9,z10,z11,z12,z13,z14,z15, x13);                              \
+        SCALAR_DOUBLE_ROUND ();                                                                  \
+        for (i = 1; i < (rounds); ++i)                                                           \
+        {                                                                                        \
+            DOUBLE_ROUND (z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15); \
+            SCALAR_DOUBLE_ROUND ();                                                              \
+        }                                                                                        \
+        BLABLA_FEED_FORWARD (z0, z1, z2, z3, z4, z5, z6, z7,                                     \
+                             z8, z9,z10,z11,z12,z13,z14,z15, x13);                               \
+    } while (0)
+
+/* Feed-forward of s into the words w */
+#define SCALAR_STORE(w)                                                        \
+    do                                                                         \
+    {                                                                          \
+        w[0] = s0 + constants[0], w[1] = s1 + constants[1];                    \
+        w[2] = s2 + constants[2], w[3] = s3 + constants[3];                    \
+        w[4] = s4 + key[0], w[5] = s5 + key[1];                                \
+        w[6] = s6 + key[2], w[7] = s7 + key[3];                                \
+        w[8] = s8 + constants[4], w[9] = s9 + constants[5];                    \
+        w[10] = s10 + constants[6], w[11] = s11 + constants[7];                \
+        w[12] = s12 + counter[0], w[13] = s13 + ctr + BLOCKS_PER_CORE;         \
+        w[14] = s14 + counter[2], w[15] = s15 + counter[3];                    \
+    } while (0)
+
+#define SCALAR_OUT(dst)                                                        \
+    do                                                                         \
+    {                                                                          \
+        uint64_t w_[16];                                                       \
+        SCALAR_STORE (w_);                                                     \
+        memcpy (dst, w_, BLOCK_LEN);                                           \
+    } while (0)
+
+#define SCALAR_XOR_OUT(src, dst)                                               \
+    do                                                                         \
+    {                                                                          \
+        uint64_t w_[16], t_[16];                                               \
+        int j_;                                                                \
+        SCALAR_STORE (w_);                                                     \
+        memcpy (t_, src, BLOCK_LEN);                                           \
+        for (j_ = 0; j_ < 16; ++j_)                                            \
+            w_[j_] ^= t_[j_];                                                  \
+        memcpy (dst, w_, BLOCK_LEN);                                           \
+    } while (0)
+
+#endif /* HYBRID_CORES */
+
+
+#if defined(HAVE_AVX512F)
+
+/* 8 blocks x 16 words: after the transpose, x(2b) and x(2b+1) hold the two
+ * halves of block b. */
+#define TRANSPOSE(x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15) \
+    do                                                                                  \
+    {                                                                                   \
+        MM_TYPE t0, t1, t2, t3, t4, t5, t6, t7;                                         \
+        MM_TYPE t8, t9, t10, t11, t12, t13, t14, t15;                                   \
+        MM_TYPE s0, s1, s2, s3, s4, s5, s6, s7;                                         \
+        MM_TYPE s8, s9, s10, s11, s12, s13, s14, s15;                                   \
+                                                                                        \
+        /* even blocks in t(2p), odd blocks in t(2p+1), words 2p and 2p+1 */            \
+        t0 = _mm512_unpacklo_epi64 (x0, x1);                                            \
+        t1 = _mm512_unpackhi_epi64 (x0, x1);                                            \
+        t2 = _mm512_unpacklo_epi64 (x2, x3);                                            \
+        t3 = _mm512_unpackhi_epi64 (x2, x3);                                            \
+        t4 = _mm512_unpacklo_epi64 (x4, x5);                                            \
+        t5 = _mm512_unpackhi_epi64 (x4, x5);                                            \
+        t6 = _mm512_unpacklo_epi64 (x6, x7);                                            \
+        t7 = _mm512_unpackhi_epi64 (x6, x7);                                            \
+        t8 = _mm512_unpacklo_epi64 (x8, x9);                                            \
+        t9 = _mm512_unpackhi_epi64 (x8, x9);                                            \
+        t10 = _mm512_unpacklo_epi64 (x10, x11);                                         \
+        t11 = _mm512_unpackhi_epi64 (x10, x11);                                         \
+        t12 = _mm512_unpacklo_epi64 (x12, x13);                                         \
+        t13 = _mm512_unpackhi_epi64 (x12, x13);                                         \
+        t14 = _mm512_unpacklo_epi64 (x14, x15);                                         \
+        t15 = _mm512_unpackhi_epi64 (x14, x15);                                         \
+                                                                                        \
+        /* blocks (0,4), (2,6), (1,5) and (3,7), two word pairs each */                 \
+        s0 = _mm512_shuffle_i64x2 (t0, t2, _MM_SHUFFLE (2, 0, 2, 0));                   \
+        s1 = _mm512_shuffle_i64x2 (t0, t2, _MM_SHUFFLE (3, 1, 3, 1));                   \
+        s2 = _mm512_shuffle_i64x2 (t4, t6, _MM_SHUFFLE (2, 0, 2, 0));                   \
+        s3 = _mm512_shuffle_i64x2 (t4, t6, _MM_SHUFFLE (3, 1, 3, 1));                   \
+        s4 = _mm512_shuffle_i64x2 (t8, t10, _MM_SHUFFLE (2, 0, 2, 0));                  \
+        s5 = _mm512_shuffle_i64x2 (t8, t10, _MM_SHUFFLE (3, 1, 3, 1));                  \
+        s6 = _mm512_shuffle_i64x2 (t12, t14, _MM_SHUFFLE (2, 0, 2, 0));                 \
+        s7 = _mm512_shuffle_i64x2 (t12, t14, _MM_SHUFFLE (3, 1, 3, 1));                 \
+        s8 = _mm512_shuffle_i64x2 (t1, t3, _MM_SHUFFLE (2, 0, 2, 0));                   \
+        s9 = _mm512_shuffle_i64x2 (t1, t3, _MM_SHUFFLE (3, 1, 3, 1));                   \
+        s10 = _mm512_shuffle_i64x2 (t5, t7, _MM_SHUFFLE (2, 0, 2, 0));                  \
+        s11 = _mm512_shuffle_i64x2 (t5, t7, _MM_SHUFFLE (3, 1, 3, 1));                  \
+        s12 = _mm512_shuffle_i64x2 (t9, t11, _MM_SHUFFLE (2, 0, 2, 0));                 \
+        s13 = _mm512_shuffle_i64x2 (t9, t11, _MM_SHUFFLE (3, 1, 3, 1));                 \
+        s14 = _mm512_shuffle_i64x2 (t13, t15, _MM_SHUFFLE (2, 0, 2, 0));                \
+        s15 = _mm512_shuffle_i64x2 (t13, t15, _MM_SHUFFLE (3, 1, 3, 1));                \
+                                                                                        \
+        x0 = _mm512_shuffle_i64x2 (s0, s2, _MM_SHUFFLE (2, 0, 2, 0));                   \
+        x8 = _mm512_shuffle_i64x2 (s0, s2, _MM_SHUFFLE (3, 1, 3, 1));                   \
+        x1 = _mm512_shuffle_i64x2 (s4, s6, _MM_SHUFFLE (2, 0, 2, 0));                   \
+        x9 = _mm512_shuffle_i64x2 (s4, s6, _MM_SHUFFLE (3, 1, 3, 1));                   \
+        x4 = _mm512_shuffle_i64x2 (s1, s3, _MM_SHUFFLE (2, 0, 2, 0));                   \
+        x12 = _mm512_shuffle_i64x2 (s1, s3, _MM_SHUFFLE (3, 1, 3, 1));                  \
+        x5 = _mm512_shuffle_i64x2 (s5, s7, _MM_SHUFFLE (2, 0, 2, 0));                   \
+        x13 = _mm512_shuffle_i64x2 (s5, s7, _MM_SHUFFLE (3, 1, 3, 1));                  \
+        x2 = _mm512_shuffle_i64x2 (s8, s10, _MM_SHUFFLE (2, 0, 2, 0));                  \
+        x10 = _mm512_shuffle_i64x2 (s8, s10, _MM_SHUFFLE (3, 1, 3, 1));                 \
+        x3 = _mm512_shuffle_i64x2 (s12, s14, _MM_SHUFFLE (2, 0, 2, 0));                 \
+        x11 = _mm512_shuffle_i64x2 (s12, s14, _MM_SHUFFLE (3, 1, 3, 1));                \
+        x6 = _mm512_shuffle_i64x2 (s9, s11, _MM_SHUFFLE (2, 0, 2, 0));                  \
+        x14 = _mm512_shuffle_i64x2 (s9, s11, _MM_SHUFFLE (3, 1, 3, 1));                 \
+        x7 = _mm512_shuffle_i64x2 (s13, s15, _MM_SHUFFLE (2, 0, 2, 0));                 \
+        x15 = _mm512_shuffle_i64x2 (s13, s15, _MM_SHUFFLE (3, 1, 3, 1));                \
+    } while (0)
+
+#elif defined(HAVE_AVX2)
 
 #define TRANSPOSE(x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15) \
     do                                                                                  \
@@ -271,22 +806,22 @@ x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, R1, R2)  \
         MM_TYPE t0, t1, t2, t3, t4, t5, t6, t7;                                         \
         MM_TYPE t8, t9, t10, t11, t12, t13, t14, t15;                                   \
                                                                                         \
-        t0 = _mm_unpacklo_epi64 (x0, x1);                                               \
-        t1 = _mm_unpackhi_epi64 (x0, x1);                                               \
-        t2 = _mm_unpacklo_epi64 (x2, x3);                                               \
-        t3 = _mm_unpackhi_epi64 (x2, x3);                                               \
-        t4 = _mm_unpacklo_epi64 (x4, x5);                                               \
-        t5 = _mm_unpackhi_epi64 (x4, x5);                                               \
-        t6 = _mm_unpacklo_epi64 (x6, x7);                                               \
-        t7 = _mm_unpackhi_epi64 (x6, x7);                                               \
-        t8 = _mm_unpacklo_epi64 (x8, x9);                                               \
-        t9 = _mm_unpackhi_epi64 (x8, x9);                                               \
-        t10 = _mm_unpacklo_epi64 (x10, x11);                                            \
-        t11 = _mm_unpackhi_epi64 (x10, x11);                                            \
-        t12 = _mm_unpacklo_epi64 (x12, x13);                                            \
-        t13 = _mm_unpackhi_epi64 (x12, x13);                                            \
-        t14 = _mm_unpacklo_epi64 (x14, x15);                                            \
-        t15 = _mm_unpackhi_epi64 (x14, x15);                                            \
+        t0 = UNPACKLO64 (x0, x1);                                                       \
+        t1 = UNPACKHI64 (x0, x1);                                                       \
+        t2 = UNPACKLO64 (x2, x3);                                                       \
+        t3 = UNPACKHI64 (x2, x3);                                                       \
+        t4 = UNPACKLO64 (x4, x5);                                                       \
+        t5 = UNPACKHI64 (x4, x5);                                                       \
+        t6 = UNPACKLO64 (x6, x7);                                                       \
+        t7 = UNPACKHI64 (x6, x7);                                                       \
+        t8 = UNPACKLO64 (x8, x9);                                                       \
+        t9 = UNPACKHI64 (x8, x9);                                                       \
+        t10 = UNPACKLO64 (x10, x11);                                                    \
+        t11 = UNPACKHI64 (x10, x11);                                                    \
+        t12 = UNPACKLO64 (x12, x13);                                                    \
+        t13 = UNPACKHI64 (x12, x13);                                                    \
+        t14 = UNPACKLO64 (x14, x15);                                                    \
+        t15 = UNPACKHI64 (x14, x15);                                                    \
                                                                                         \
         x0 = t0;                                                                        \
         x1 = t2;                                                                        \
@@ -306,59 +841,62 @@ x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, R1, R2)  \
         x15 = t15;                                                                      \
     } while (0)
 
-#endif /* HAVE_AVX2 */
+#endif /* HAVE_AVX512F */
 
-#define BLABLA_STORE(dst, z, i)                                                \
-    STOREU (dst + i * 8 * BLOCKS_PER_CORE, z ## i)
+#define BLABLA_STORE(dst, z, i, STORE_)                                        \
+    STORE_ (dst + i * 8 * BLOCKS_PER_CORE, z ## i)
 
-#define BLABLA_OUT(dst)                                                                   \
+#define BLABLA_OUT_(dst, STORE_)                                                          \
     do                                                                                    \
     {                                                                                     \
         TRANSPOSE (z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15); \
-        BLABLA_STORE (dst, z, 0);                                                         \
-        BLABLA_STORE (dst, z, 1);                                                         \
-        BLABLA_STORE (dst, z, 2);                                                         \
-        BLABLA_STORE (dst, z, 3);                                                         \
-        BLABLA_STORE (dst, z, 4);                                                         \
-        BLABLA_STORE (dst, z, 5);                                                         \
-        BLABLA_STORE (dst, z, 6);                                                         \
-        BLABLA_STORE (dst, z, 7);                                                         \
-        BLABLA_STORE (dst, z, 8);                                                         \
-        BLABLA_STORE (dst, z, 9);                                                         \
-        BLABLA_STORE (dst, z, 10);                                                        \
-        BLABLA_STORE (dst, z, 11);                                                        \
-        BLABLA_STORE (dst, z, 12);                                                        \
-        BLABLA_STORE (dst, z, 13);                                                        \
-        BLABLA_STORE (dst, z, 14);                                                        \
-        BLABLA_STORE (dst, z, 15);                                                        \
-    } while (0)
-
-#define BLABLA_XOR_STORE(src, dst, z, i)                                       \
-    STOREU (dst + i * 8 * BLOCKS_PER_CORE,                                     \
-            XOR (z ## i, LOADU (src + i * 8 * BLOCKS_PER_CORE)))
-
-#define BLABLA_XOR_OUT(src, dst)                                                          \
+        BLABLA_STORE (dst, z, 0, STORE_);                                                 \
+        BLABLA_STORE (dst, z, 1, STORE_);                                                 \
+        BLABLA_STORE (dst, z, 2, STORE_);                                                 \
+        BLABLA_STORE (dst, z, 3, STORE_);                                                 \
+        BLABLA_STORE (dst, z, 4, STORE_);                                                 \
+        BLABLA_STORE (dst, z, 5, STORE_);                                                 \
+        BLABLA_STORE (dst, z, 6, STORE_);                                                 \
+        BLABLA_STORE (dst, z, 7, STORE_);                                                 \
+        BLABLA_STORE (dst, z, 8, STORE_);                                                 \
+        BLABLA_STORE (dst, z, 9, STORE_);                                                 \
+        BLABLA_STORE (dst, z, 10, STORE_);                                                \
+        BLABLA_STORE (dst, z, 11, STORE_);                                                \
+        BLABLA_STORE (dst, z, 12, STORE_);                                                \
+        BLABLA_STORE (dst, z, 13, STORE_);                                                \
+        BLABLA_STORE (dst, z, 14, STORE_);                                                \
+        BLABLA_STORE (dst, z, 15, STORE_);                                                \
+    } while (0)
+
+#define BLABLA_XOR_STORE(src, dst, z, i, LOAD_, STORE_)                        \
+    STORE_ (dst + i * 8 * BLOCKS_PER_CORE,                                     \
+            XOR (z ## i, LOAD_ (src + i * 8 * BLOCKS_PER_CORE)))
+
+#define BLABLA_XOR_OUT_(src, dst, LOAD_, STORE_)                                          \
     do                                                                                    \
     {                                                                                     \
         TRANSPOSE (z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15); \
-        BLABLA_XOR_STORE (src, dst, z, 0);                                                \
-        BLABLA_XOR_STORE (src, dst, z, 1);                                                \
-        BLABLA_XOR_STORE (src, dst, z, 2);                                                \
-        BLABLA_XOR_STORE (src, dst, z, 3);                                                \
-        BLABLA_XOR_STORE (src, dst, z, 4);                                                \
-        BLABLA_XOR_STORE (src, dst, z, 5);                                                \
-        BLABLA_XOR_STORE (src, dst, z, 6);                                                \
-        BLABLA_XOR_STORE (src, dst, z, 7);                                                \
-        BLABLA_XOR_STORE (src, dst, z, 8);                                                \
-        BLABLA_XOR_STORE (src, dst, z, 9);                                                \
-        BLABLA_XOR_STORE (src, dst, z, 10);                                               \
-        BLABLA_XOR_STORE (src, dst, z, 11);                                               \
-        BLABLA_XOR_STORE (src, dst, z, 12);                                               \
-        BLABLA_XOR_STORE (src, dst, z, 13);                                               \
-        BLABLA_XOR_STORE (src, dst, z, 14);                                               \
-        BLABLA_XOR_STORE (src, dst, z, 15);                                               \
+        BLABLA_XOR_STORE (src, dst, z, 0, LOAD_, STORE_);                                 \
+        BLABLA_XOR_STORE (src, dst, z, 1, LOAD_, STORE_);                                 \
+        BLABLA_XOR_STORE (src, dst, z, 2, LOAD_, STORE_);                                 \
+        BLABLA_XOR_STORE (src, dst, z, 3, LOAD_, STORE_);                                 \
+        BLABLA_XOR_STORE (src, dst, z, 4, LOAD_, STORE_);                                 \
+        BLABLA_XOR_STORE (src, dst, z, 5, LOAD_, STORE_);                                 \
+        BLABLA_XOR_STORE (src, dst, z, 6, LOAD_, STORE_);                                 \
+        BLABLA_XOR_STORE (src, dst, z, 7, LOAD_, STORE_);                                 \
+        BLABLA_XOR_STORE (src, dst, z, 8, LOAD_, STORE_);                                 \
+        BLABLA_XOR_STORE (src, dst, z, 9, LOAD_, STORE_);                                 \
+        BLABLA_XOR_STORE (src, dst, z, 10, LOAD_, STORE_);                                \
+        BLABLA_XOR_STORE (src, dst, z, 11, LOAD_, STORE_);                                \
+        BLABLA_XOR_STORE (src, dst, z, 12, LOAD_, STORE_);                                \
+        BLABLA_XOR_STORE (src, dst, z, 13, LOAD_, STORE_);                                \
+        BLABLA_XOR_STORE (src, dst, z, 14, LOAD_, STORE_);                                \
+        BLABLA_XOR_STORE (src, dst, z, 15, LOAD_, STORE_);                                \
     } while (0)
 
+#define BLABLA_OUT(dst)          BLABLA_OUT_ (dst, STOREU)
+#define BLABLA_XOR_OUT(src, dst) BLABLA_XOR_OUT_ (src, dst, LOADU, STOREU)
+
 
 #define BLABLA_INIT(x0, x1, x2, x3, x4, x5, x6, x7,                            \
                     x8, x9,x10,x11,x12,x13,x14,x15,                            \
@@ -385,115 +923,776 @@ x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, R1, R2)  \
         x15 = SET1_EPI64x (counter[3]);                                        \
     } while (0)
 
+/* Same from a prepared key, whose rows hold each word in every lane */
+#define BLABLA_INIT_KEY(x0, x1, x2, x3, x4, x5, x6, x7,                        \
+                        x8, x9,x10,x11,x12,x13,x14,x15,                        \
+                        pk, counter)                                           \
+    do                                                                         \
+    {                                                                          \
+        x0 = LOADU ((pk)->lanes[0]);                                           \
+        x1 = LOADU ((pk)->lanes[1]);                                           \
+        x2 = LOADU ((pk)->lanes[2]);                                           \
+        x3 = LOADU ((pk)->lanes[3]);                                           \
+        x4 = LOADU ((pk)->lanes[4]);                                           \
+        x5 = LOADU ((pk)->lanes[5]);                                           \
+        x6 = LOADU ((pk)->lanes[6]);                                           \
+        x7 = LOADU ((pk)->lanes[7]);                                           \
+        x8 = LOADU ((pk)->lanes[8]);                                           \
+        x9 = LOADU ((pk)->lanes[9]);                                           \
+        x10 = LOADU ((pk)->lanes[10]);                                         \
+        x11 = LOADU ((pk)->lanes[11]);                                         \
+        x12 = LOADU ((pk)->lanes[12]);                                         \
+                                                                               \
+        x13 = SET1_EPI64x (counter[1]);                                        \
+        x14 = SET1_EPI64x (counter[2]);                                        \
+        x15 = SET1_EPI64x (counter[3]);                                        \
+    } while (0)
+
 
-void blabla_ctxt_keystream (blabla_ctxt *ctxt, uint8_t *out, uint64_t len)
-{
-    MM_TYPE x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
-    MM_TYPE z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15;
+/*
+ * Latency-oriented code for the end of a message, when less than a core's
+ * worth of output is left.
+ *
+ * The store helpers write v to dst + off, XORed with src + off unless src is
+ * NULL (keystream). The partial versions only touch the first n bytes, so
+ * that nothing is read or written past the end of the buffers.
+ */
 
-    uint64_t *key = ctxt->key;
-    uint64_t *counter = ctxt->counter;
+#ifdef BLABLA_GENERIC
 
-    BLABLA_INIT (x0, x1, x2, x3, x4, x5, x6, x7,
-                 x8, x9,x10,x11,x12,x13,x14,x15,
-                 constants, key, counter);
+static inline void store_128 (const uint8_t *src, uint8_t *dst, uint64_t off, MM_TYPE v)
+{
+    if (src != NULL)
+        v = XOR (v, LOADU (src + off));
+    STOREU (dst + off, v);
+}
 
-    /* Increment counter */
-    x13 = ADD (x13, INIT_COUNTER);
+static inline void
+store_partial_128 (const uint8_t *src, uint8_t *dst, uint64_t off, MM_TYPE v, uint64_t n)
+{
+    MM_TYPE t = SET1_EPI64x (0);
 
-    while (len >= BLOCKS_PER_CORE * BLOCK_LEN)
+    if (src != NULL)
     {
-        BLABLA_CORE (z0, z1, z2, z3, z4, z5, z6, z7,
-                     z8, z9,z10,z11,z12,z13,z14,z15,
-                     x0, x1, x2, x3, x4, x5, x6, x7,
-                     x8, x9,x10,x11,x12,x13,x14,x15);
-        BLABLA_OUT (out);
+        memcpy (&t, src + off, n);
+        v = XOR (v, t);
+    }
+    memcpy (dst + off, &v, n);
+}
 
-        /* Increment counter */
-        x13 = ADD (x13, SET1_EPI64x (BLOCKS_PER_CORE));
+#else /* !BLABLA_GENERIC */
 
-        out += BLOCKS_PER_CORE * BLOCK_LEN;
-        len -= BLOCKS_PER_CORE * BLOCK_LEN;
-    }
+static inline void store_128 (const uint8_t *src, uint8_t *dst, uint64_t off, __m128i v)
+{
+    if (src != NULL)
+        v = _mm_xor_si128 (v, _mm_loadu_si128 ((const __m128i *)(src + off)));
+    _mm_storeu_si128 ((__m128i *)(dst + off), v);
+}
 
-    if (len > 0) /* Should fallback to latency-oriented implementation here */
+static inline void
+store_partial_128 (const uint8_t *src, uint8_t *dst, uint64_t off, __m128i v, uint64_t n)
+{
+#ifdef HAVE_AVX512BW
+    __mmask16 m = (__mmask16) ((1U << n) - 1);
+
+    if (src != NULL)
+        v = _mm_xor_si128 (v, _mm_maskz_loadu_epi8 (m, src + off));
+    _mm_mask_storeu_epi8 (dst + off, m, v);
+#else
+    uint64_t w, t;
+
+    if (n >= 8)
     {
-        uint8_t block[BLOCKS_PER_CORE * BLOCK_LEN];
-        BLABLA_CORE (z0, z1, z2, z3, z4, z5, z6, z7,
-                     z8, z9,z10,z11,z12,z13,z14,z15,
-                     x0, x1, x2, x3, x4, x5, x6, x7,
-                     x8, x9,x10,x11,x12,x13,x14,x15);
-        BLABLA_OUT (block);
+        _mm_storel_epi64 ((__m128i *)&w, v);
+        if (src != NULL)
+        {
+            memcpy (&t, src + off, 8);
+            w ^= t;
+        }
+        memcpy (dst + off, &w, 8);
+        v = _mm_unpackhi_epi64 (v, v);
+        off += 8;
+        n -= 8;
+    }
 
-        memcpy (out, block, len);
+    _mm_storel_epi64 ((__m128i *)&w, v);
+    if (src != NULL)
+    {
+        t = 0;
+        memcpy (&t, src + off, n);
+        w ^= t;
     }
+    memcpy (dst + off, &w, n);
+#endif
 }
 
-int blabla_keystream (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k)
-{
-    blabla_ctxt ctxt;
-    blabla_ctxt_init (&ctxt, k, n);
-    blabla_ctxt_keystream (&ctxt, out, outlen);
-    return 0;
-}
+#endif /* BLABLA_GENERIC */
 
-#ifdef SUPERCOP
-int crypto_stream (unsigned char *out,
-                   unsigned long long outlen,
-                   const unsigned char *n,
-                   const unsigned char *k)
+#ifdef HAVE_AVX2
+
+static inline void store_256 (const uint8_t *src, uint8_t *dst, uint64_t off, __m256i v)
 {
-    return blabla_keystream (out, outlen, n, k);
+    if (src != NULL)
+        v = _mm256_xor_si256 (v, _mm256_loadu_si256 ((const __m256i *)(src + off)));
+    _mm256_storeu_si256 ((__m256i *)(dst + off), v);
 }
-#endif
 
-void blabla_ctxt_xor (blabla_ctxt *ctxt, const uint8_t *in, uint8_t *out, uint64_t len)
+static inline void
+store_partial_256 (const uint8_t *src, uint8_t *dst, uint64_t off, __m256i v, uint64_t n)
 {
-    MM_TYPE x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
-    MM_TYPE z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15;
+#ifdef HAVE_AVX512BW
+    __mmask32 m = (__mmask32) ((1ULL << n) - 1);
 
-    uint64_t *key = ctxt->key;
-    uint64_t *counter = ctxt->counter;
+    if (src != NULL)
+        v = _mm256_xor_si256 (v, _mm256_maskz_loadu_epi8 (m, src + off));
+    _mm256_mask_storeu_epi8 (dst + off, m, v);
+#else
+    __m128i h = _mm256_castsi256_si128 (v);
 
-    BLABLA_INIT (x0, x1, x2, x3, x4, x5, x6, x7,
-                 x8, x9,x10,x11,x12,x13,x14,x15,
-                 constants, key, counter);
-
-    /* Increment counter */
-    x13 = ADD (x13, INIT_COUNTER);
-
-    while (len >= BLOCKS_PER_CORE * BLOCK_LEN)
+    if (n >= 16)
     {
-        BLABLA_CORE (z0, z1, z2, z3, z4, z5, z6, z7,
-                     z8, z9,z10,z11,z12,z13,z14,z15,
-                     x0, x1, x2, x3, x4, x5, x6, x7,
-                     x8, x9,x10,x11,x12,x13,x14,x15);
-        BLABLA_XOR_OUT (in, out);
+        store_128 (src, dst, off, h);
+        h = _mm256_extracti128_si256 (v, 1);
+        off += 16;
+        n -= 16;
+    }
+    if (n > 0)
+        store_partial_128 (src, dst, off, h, n);
+#endif
+}
+
+#endif /* HAVE_AVX2 */
+
+#ifdef HAVE_AVX512F
+
+static inline void store_512 (const uint8_t *src, uint8_t *dst, uint64_t off, __m512i v)
+{
+    if (src != NULL)
+        v = _mm512_xor_si512 (v, _mm512_loadu_si512 ((const void *)(src + off)));
+    _mm512_storeu_si512 ((void *)(dst + off), v);
+}
+
+static inline void
+store_partial_512 (const uint8_t *src, uint8_t *dst, uint64_t off, __m512i v, uint64_t n)
+{
+    __mmask64 m = (__mmask64) ((1ULL << n) - 1);
+
+    if (src != NULL)
+        v = _mm512_xor_si512 (v, _mm512_maskz_loadu_epi8 (m, src + off));
+    _mm512_mask_storeu_epi8 (dst + off, m, v);
+}
+
+#endif /* HAVE_AVX512F */
+
+/* Writes v as the i-th W-bit chunk of an output of len bytes, and leaves the
+ * enclosing do-while loop once the output is complete. */
+#define TAIL_STORE_(src, dst, len, i, v, W)                                    \
+    if ((len) <= (i) * ((W) / 8))                                              \
+        break;                                                                 \
+    if ((len) < ((i) + 1) * ((W) / 8))                                         \
+    {                                                                          \
+        store_partial_##W (src, dst, (i) * ((W) / 8), v, (len) - (i) * ((W) / 8)); \
+        break;                                                                 \
+    }                                                                          \
+    store_##W (src, dst, (i) * ((W) / 8), v)
+
+#define TAIL_STORE(src, dst, len, i, v, W) TAIL_STORE_ (src, dst, len, i, v, W)
+
+/* Same as BLABLA_XOR_OUT (or BLABLA_OUT if src is NULL) for len bytes */
+#define BLABLA_TAIL_OUT(src, dst, len)                                                    \
+    do                                                                                    \
+    {                                                                                     \
+        TRANSPOSE (z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15); \
+        do                                                                                \
+        {                                                                                 \
+            TAIL_STORE (src, dst, len, 0, z0, MM_BITS);                                   \
+            TAIL_STORE (src, dst, len, 1, z1, MM_BITS);                                   \
+            TAIL_STORE (src, dst, len, 2, z2, MM_BITS);                                   \
+            TAIL_STORE (src, dst, len, 3, z3, MM_BITS);                                   \
+            TAIL_STORE (src, dst, len, 4, z4, MM_BITS);                                   \
+            TAIL_STORE (src, dst, len, 5, z5, MM_BITS);                                   \
+            TAIL_STORE (src, dst, len, 6, z6, MM_BITS);                                   \
+            TAIL_STORE (src, dst, len, 7, z7, MM_BITS);                                   \
+            TAIL_STORE (src, dst, len, 8, z8, MM_BITS);                                   \
+            TAIL_STORE (src, dst, len, 9, z9, MM_BITS);                                   \
+            TAIL_STORE (src, dst, len, 10, z10, MM_BITS);                                 \
+            TAIL_STORE (src, dst, len, 11, z11, MM_BITS);                                 \
+            TAIL_STORE (src, dst, len, 12, z12, MM_BITS);                                 \
+            TAIL_STORE (src, dst, len, 13, z13, MM_BITS);                                 \
+            TAIL_STORE (src, dst, len, 14, z14, MM_BITS);                                 \
+            TAIL_STORE (src, dst, len, 15, z15, MM_BITS);                                 \
+        } while (0);                                                                      \
+    } while (0)
+
+
+/*
+ * Row-oriented kernels: one block is kept as four rows of four words
+ * (a = x0..x3, b = x4..x7, c = x8..x11, d = x12..x15), so that the column
+ * round is a single G on rows. Rotating rows b, c, d by one, two and three
+ * words lines the diagonals up as columns for the diagonal round.
+ */
+
+#ifdef HAVE_AVX2
+
+/* One row per 256-bit vector */
+#define ROW_ADD(A, B) _mm256_add_epi64 (A, B)
+#define ROW_XOR(A, B) _mm256_xor_si256 (A, B)
+#ifdef HAVE_AVX512VL
+#define ROW_ROT(X, R) _mm256_ror_epi64 ((X), (R))
+#else
+#define ROW_ROT(X, R) ROT (X, R)
+#endif
+
+#define ROW_DOUBLE_ROUND(a, b, c, d, ADD_, XOR_, ROT_, PERMUTE)                \
+    do                                                                         \
+    {                                                                          \
+        G (a, b, c, d, ADD_, XOR_, ROT_);                                      \
+        b = PERMUTE (b, _MM_SHUFFLE (0, 3, 2, 1));                             \
+        c = PERMUTE (c, _MM_SHUFFLE (1, 0, 3, 2));                             \
+        d = PERMUTE (d, _MM_SHUFFLE (2, 1, 0, 3));                             \
+        G (a, b, c, d, ADD_, XOR_, ROT_);                                      \
+        b = PERMUTE (b, _MM_SHUFFLE (2, 1, 0, 3));                             \
+        c = PERMUTE (c, _MM_SHUFFLE (1, 0, 3, 2));                             \
+        d = PERMUTE (d, _MM_SHUFFLE (0, 3, 2, 1));                             \
+    } while (0)
+
+static void blabla_block (const uint64_t *key, const uint64_t *counter, uint64_t ctr,
+                          const uint8_t *in, uint8_t *out, uint64_t len, int rounds)
+{
+    __m256i x0, x1, x2, x3;
+    __m256i z0, z1, z2, z3;
+    int i;
+
+    x0 = _mm256_loadu_si256 ((const __m256i *)&constants[0]);
+    x1 = _mm256_loadu_si256 ((const __m256i *)key);
+    x2 = _mm256_loadu_si256 ((const __m256i *)&constants[4]);
+    x3 = _mm256_set_epi64x (counter[3], counter[2], ctr, counter[0]);
+
+    z0 = x0, z1 = x1, z2 = x2, z3 = x3;
+    for (i = 0; i < rounds; ++i)
+        ROW_DOUBLE_ROUND (z0, z1, z2, z3, ROW_ADD, ROW_XOR, ROW_ROT, _mm256_permute4x64_epi64);
+
+    z0 = ROW_ADD (x0, z0);
+    z1 = ROW_ADD (x1, z1);
+    z2 = ROW_ADD (x2, z2);
+    z3 = ROW_ADD (x3, z3);
+
+    do
+    {
+        TAIL_STORE (in, out, len, 0, z0, 256);
+        TAIL_STORE (in, out, len, 1, z1, 256);
+        TAIL_STORE (in, out, len, 2, z2, 256);
+        TAIL_STORE (in, out, len, 3, z3, 256);
+    } while (0);
+}
+
+#ifdef HAVE_AVX512F
+
+/* Two blocks side by side, one row of each per 512-bit vector */
+static void blabla_2blocks (const uint64_t *key, const uint64_t *counter, uint64_t ctr,
+                            const uint8_t *in, uint8_t *out, uint64_t len, int rounds)
+{
+    __m512i x0, x1, x2, x3;
+    __m512i z0, z1, z2, z3;
+    int i;
+
+    x0 = _mm512_broadcast_i64x4 (_mm256_loadu_si256 ((const __m256i *)&constants[0]));
+    x1 = _mm512_broadcast_i64x4 (_mm256_loadu_si256 ((const __m256i *)key));
+    x2 = _mm512_broadcast_i64x4 (_mm256_loadu_si256 ((const __m256i *)&constants[4]));
+    x3 = _mm512_set_epi64 (counter[3], counter[2], ctr + 1, counter[0],
+                           counter[3], counter[2], ctr, counter[0]);
+
+    z0 = x0, z1 = x1, z2 = x2, z3 = x3;
+    for (i = 0; i < rounds; ++i)
+        ROW_DOUBLE_ROUND (z0, z1, z2, z3, ADD, XOR, ROT, _mm512_permutex_epi64);
+
+    z0 = ADD (x0, z0);
+    z1 = ADD (x1, z1);
+    z2 = ADD (x2, z2);
+    z3 = ADD (x3, z3);
+
+    /* Back to block order */
+    x0 = _mm512_shuffle_i64x2 (z0, z1, _MM_SHUFFLE (1, 0, 1, 0));
+    x1 = _mm512_shuffle_i64x2 (z2, z3, _MM_SHUFFLE (1, 0, 1, 0));
+    x2 = _mm512_shuffle_i64x2 (z0, z1, _MM_SHUFFLE (3, 2, 3, 2));
+    x3 = _mm512_shuffle_i64x2 (z2, z3, _MM_SHUFFLE (3, 2, 3, 2));
+
+    do
+    {
+        TAIL_STORE (in, out, len, 0, x0, 512);
+        TAIL_STORE (in, out, len, 1, x1, 512);
+        TAIL_STORE (in, out, len, 2, x2, 512);
+        TAIL_STORE (in, out, len, 3, x3, 512);
+    } while (0);
+}
+
+#else /* !HAVE_AVX512F */
+
+/* Two interleaved one-block states */
+static void blabla_2blocks (const uint64_t *key, const uint64_t *counter, uint64_t ctr,
+                            const uint8_t *in, uint8_t *out, uint64_t len, int rounds)
+{
+    __m256i x0, x1, x2, x3, x7;
+    __m256i z0, z1, z2, z3, z4, z5, z6, z7;
+    int i;
+
+    x0 = _mm256_loadu_si256 ((const __m256i *)&constants[0]);
+    x1 = _mm256_loadu_si256 ((const __m256i *)key);
+    x2 = _mm256_loadu_si256 ((const __m256i *)&constants[4]);
+    x3 = _mm256_set_epi64x (counter[3], counter[2], ctr, counter[0]);
+    x7 = _mm256_set_epi64x (counter[3], counter[2], ctr + 1, counter[0]);
+
+    z0 = x0, z1 = x1, z2 = x2, z3 = x3;
+    z4 = x0, z5 = x1, z6 = x2, z7 = x7;
+    for (i = 0; i < rounds; ++i)
+    {
+        ROW_DOUBLE_ROUND (z0, z1, z2, z3, ROW_ADD, ROW_XOR, ROW_ROT, _mm256_permute4x64_epi64);
+        ROW_DOUBLE_ROUND (z4, z5, z6, z7, ROW_ADD, ROW_XOR, ROW_ROT, _mm256_permute4x64_epi64);
+    }
+
+    z0 = ROW_ADD (x0, z0);
+    z1 = ROW_ADD (x1, z1);
+    z2 = ROW_ADD (x2, z2);
+    z3 = ROW_ADD (x3, z3);
+    z4 = ROW_ADD (x0, z4);
+    z5 = ROW_ADD (x1, z5);
+    z6 = ROW_ADD (x2, z6);
+    z7 = ROW_ADD (x7, z7);
+
+    do
+    {
+        TAIL_STORE (in, out, len, 0, z0, 256);
+        TAIL_STORE (in, out, len, 1, z1, 256);
+        TAIL_STORE (in, out, len, 2, z2, 256);
+        TAIL_STORE (in, out, len, 3, z3, 256);
+        TAIL_STORE (in, out, len, 4, z4, 256);
+        TAIL_STORE (in, out, len, 5, z5, 256);
+        TAIL_STORE (in, out, len, 6, z6, 256);
+        TAIL_STORE (in, out, len, 7, z7, 256);
+    } while (0);
+}
+
+#endif /* HAVE_AVX512F */
+
+#else /* !HAVE_AVX2 */
+
+/* One row per pair of 128-bit vectors, as in BLAKE2b. ALIGNR (x, y) is
+ * (y[1], x[0]). */
+#if defined(BLABLA_GENERIC)
+#define ALIGNR(x, y) ((MM_TYPE){ (y)[1], (x)[0] })
+#elif defined(HAVE_SSSE3)
+#define ALIGNR(x, y) _mm_alignr_epi8 ((x), (y), 8)
+#else
+#define ALIGNR(x, y)                                                           \
+    _mm_castpd_si128 (_mm_shuffle_pd (_mm_castsi128_pd (y), _mm_castsi128_pd (x), 1))
+#endif
+
+#define ROW_DOUBLE_ROUND(z0, z1, z2, z3, z4, z5, z6, z7)                       \
+    do                                                                         \
+    {                                                                          \
+        MM_TYPE t0, t1;                                                        \
+                                                                               \
+        QUARTER_ROUND (z0, z2, z4, z6);                                        \
+        QUARTER_ROUND (z1, z3, z5, z7);                                        \
+        t0 = ALIGNR (z3, z2), t1 = ALIGNR (z2, z3), z2 = t0, z3 = t1;          \
+        t0 = z4, z4 = z5, z5 = t0;                                             \
+        t0 = ALIGNR (z6, z7), t1 = ALIGNR (z7, z6), z6 = t0, z7 = t1;          \
+        QUARTER_ROUND (z0, z2, z4, z6);                                        \
+        QUARTER_ROUND (z1, z3, z5, z7);                                        \
+        t0 = ALIGNR (z2, z3), t1 = ALIGNR (z3, z2), z2 = t0, z3 = t1;          \
+        t0 = z4, z4 = z5, z5 = t0;                                             \
+        t0 = ALIGNR (z7, z6), t1 = ALIGNR (z6, z7), z6 = t0, z7 = t1;          \
+    } while (0)
+
+static void blabla_block (const uint64_t *key, const uint64_t *counter, uint64_t ctr,
+                          const uint8_t *in, uint8_t *out, uint64_t len, int rounds)
+{
+    MM_TYPE x0, x1, x2, x3, x4, x5, x6, x7;
+    MM_TYPE z0, z1, z2, z3, z4, z5, z6, z7;
+    int i;
+
+    x0 = LOADU (&constants[0]);
+    x1 = LOADU (&constants[2]);
+    x2 = LOADU (&key[0]);
+    x3 = LOADU (&key[2]);
+    x4 = LOADU (&constants[4]);
+    x5 = LOADU (&constants[6]);
+    x6 = SET_EPI64x2 (ctr, counter[0]);
+    x7 = LOADU (&counter[2]);
+
+    z0 = x0, z1 = x1, z2 = x2, z3 = x3, z4 = x4, z5 = x5, z6 = x6, z7 = x7;
+    for (i = 0; i < rounds; ++i)
+        ROW_DOUBLE_ROUND (z0, z1, z2, z3, z4, z5, z6, z7);
+
+    z0 = ADD (x0, z0);
+    z1 = ADD (x1, z1);
+    z2 = ADD (x2, z2);
+    z3 = ADD (x3, z3);
+    z4 = ADD (x4, z4);
+    z5 = ADD (x5, z5);
+    z6 = ADD (x6, z6);
+    z7 = ADD (x7, z7);
+
+    do
+    {
+        TAIL_STORE (in, out, len, 0, z0, 128);
+        TAIL_STORE (in, out, len, 1, z1, 128);
+        TAIL_STORE (in, out, len, 2, z2, 128);
+        TAIL_STORE (in, out, len, 3, z3, 128);
+        TAIL_STORE (in, out, len, 4, z4, 128);
+        TAIL_STORE (in, out, len, 5, z5, 128);
+        TAIL_STORE (in, out, len, 6, z6, 128);
+        TAIL_STORE (in, out, len, 7, z7, 128);
+    } while (0);
+}
+
+#endif /* HAVE_AVX2 */
+
+/* At most half a core left, starting at block counter ctr: 2-block kernels
+ * while more than one block is left, then a single block. With 2 blocks per
+ * core, the caller handles the 2-block case with BLABLA_CORE. */
+static void blabla_tail (const uint64_t *key, const uint64_t *counter, uint64_t ctr,
+                         const uint8_t *in, uint8_t *out, uint64_t len, int rounds)
+{
+#if BLOCKS_PER_CORE > 2
+    while (len > BLOCK_LEN)
+    {
+        uint64_t n = len < 2 * BLOCK_LEN ? len : 2 * BLOCK_LEN;
+
+        blabla_2blocks (key, counter, ctr, in, out, n, rounds);
+
+        ctr += 2;
+        if (in != NULL)
+            in += n;
+        out += n;
+        len -= n;
+    }
+#endif
+
+    if (len > 0)
+        blabla_block (key, counter, ctr, in, out, len, rounds);
+}
+
+
+/*
+ * Outputs much larger than the cache are written with non-temporal stores,
+ * so that they do not evict the working set of the rest of the process. This
+ * needs out to be aligned on a vector; the input is prefetched a few cores
+ * ahead, since nothing else will bring it into the cache in time.
+ */
+#ifndef NT_THRESHOLD
+#define NT_THRESHOLD (8 << 20)
+#endif
+#define PREFETCH_CORES 4
+
+#define IS_ALIGNED(p) (((uintptr_t)(p) & (MM_BITS / 8 - 1)) == 0)
+
+static inline void prefetch_core (const uint8_t *p)
+{
+    int i;
+
+    for (i = 0; i < BLOCKS_PER_CORE * BLOCK_LEN; i += 64)
+        __builtin_prefetch (p + i, 0, 3);
+}
+
+#define BLABLA_XOR_NT_LOOP(LOAD_)                                              \
+    while (len >= BLOCKS_PER_CORE * BLOCK_LEN)                                 \
+    {                                                                          \
+        if (len >= (PREFETCH_CORES + 1) * BLOCKS_PER_CORE * BLOCK_LEN)         \
+            prefetch_core (in + PREFETCH_CORES * BLOCKS_PER_CORE * BLOCK_LEN); \
+        BLABLA_CORE_P (rounds);                                                \
+        BLABLA_XOR_OUT_ (in, out, LOAD_, STREAM);                              \
+                                                                               \
+        x13 = ADD (x13, SET1_EPI64x (BLOCKS_PER_CORE));                        \
+        ctr += BLOCKS_PER_CORE;                                                \
+                                                                               \
+        in += BLOCKS_PER_CORE * BLOCK_LEN;                                     \
+        out += BLOCKS_PER_CORE * BLOCK_LEN;                                    \
+        len -= BLOCKS_PER_CORE * BLOCK_LEN;                                    \
+    }
+
+
+/* The bulk functions take the number of double rounds as a constant, so that
+ * each round count gets its own specialized copy */
+static inline __attribute__ ((always_inline)) void
+state_keystream_core (const blabla_key *pk, const uint64_t *key, uint64_t *counter,
+                      uint8_t *out, uint64_t len, const int rounds)
+{
+    MM_TYPE x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
+    MM_TYPE z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15;
+    MM_TYPE p0, p2, p3, p4, p6, p7, p8, p10, p11, p12, p14, p15;
+
+    uint64_t ctr = counter[1];
+
+    /* Advance the context past the blocks used by this call */
+    counter[1] += (len + BLOCK_LEN - 1) / BLOCK_LEN;
+
+    if (len <= BLOCKS_PER_CORE * BLOCK_LEN / 2)
+    {
+        STATS_TAIL (len);
+        blabla_tail (key, counter, ctr, NULL, out, len, rounds);
+        return;
+    }
+
+    if (pk != NULL)
+        BLABLA_INIT_KEY (x0, x1, x2, x3, x4, x5, x6, x7,
+                         x8, x9,x10,x11,x12,x13,x14,x15,
+                         pk, counter);
+    else
+        BLABLA_INIT (x0, x1, x2, x3, x4, x5, x6, x7,
+                     x8, x9,x10,x11,x12,x13,x14,x15,
+                     constants, key, counter);
+    x13 = SET1_EPI64x (ctr);
+
+    /* Increment counter */
+    x13 = ADD (x13, INIT_COUNTER);
+    BLABLA_PRECOMPUTE ();
+
+    if (len >= NT_THRESHOLD && IS_ALIGNED (out))
+    {
+        while (len >= BLOCKS_PER_CORE * BLOCK_LEN)
+        {
+            BLABLA_CORE_P (rounds);
+            BLABLA_OUT_ (out, STREAM);
+
+            x13 = ADD (x13, SET1_EPI64x (BLOCKS_PER_CORE));
+            ctr += BLOCKS_PER_CORE;
+
+            out += BLOCKS_PER_CORE * BLOCK_LEN;
+            len -= BLOCKS_PER_CORE * BLOCK_LEN;
+        }
+        STREAM_FENCE ();
+    }
+
+#ifdef HYBRID_CORES
+    while (len >= (BLOCKS_PER_CORE + 1) * BLOCK_LEN)
+    {
+        uint64_t s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11, s12, s13, s14, s15;
+
+        BLABLA_CORE_H (rounds);
+        BLABLA_OUT (out);
+        SCALAR_OUT (out + BLOCKS_PER_CORE * BLOCK_LEN);
+
+        x13 = ADD (x13, SET1_EPI64x (BLOCKS_PER_CORE + 1));
+        ctr += BLOCKS_PER_CORE + 1;
+
+        out += (BLOCKS_PER_CORE + 1) * BLOCK_LEN;
+        len -= (BLOCKS_PER_CORE + 1) * BLOCK_LEN;
+    }
+#endif
+
+#if defined(INTERLEAVE_CORES) && !defined(HYBRID_CORES)
+    while (len >= 2 * BLOCKS_PER_CORE * BLOCK_LEN)
+    {
+        MM_TYPE y0, y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15;
+
+        BLABLA_CORE2_P (rounds);
+        BLABLA_OUT (out);
+        BLABLA_NEXT_CORE ();
+        BLABLA_OUT (out + BLOCKS_PER_CORE * BLOCK_LEN);
+
+        x13 = ADD (x13, SET1_EPI64x (2 * BLOCKS_PER_CORE));
+        ctr += 2 * BLOCKS_PER_CORE;
+
+        out += 2 * BLOCKS_PER_CORE * BLOCK_LEN;
+        len -= 2 * BLOCKS_PER_CORE * BLOCK_LEN;
+    }
+#endif
+
+    while (len >= BLOCKS_PER_CORE * BLOCK_LEN)
+    {
+        BLABLA_CORE_P (rounds);
+        BLABLA_OUT (out);
 
         /* Increment counter */
         x13 = ADD (x13, SET1_EPI64x (BLOCKS_PER_CORE));
+        ctr += BLOCKS_PER_CORE;
 
         out += BLOCKS_PER_CORE * BLOCK_LEN;
         len -= BLOCKS_PER_CORE * BLOCK_LEN;
     }
 
-    if (len > 0) /* Should fallback to latency-oriented implementation here */
+    STATS_TAIL (len);
+    if (len > BLOCKS_PER_CORE * BLOCK_LEN / 2)
+    {
+        BLABLA_CORE_P (rounds);
+        BLABLA_TAIL_OUT ((const uint8_t *)NULL, out, len);
+    }
+    else if (len > 0)
     {
-        uint8_t inblock[BLOCKS_PER_CORE * BLOCK_LEN];
-        uint8_t outblock[BLOCKS_PER_CORE * BLOCK_LEN];
+        blabla_tail (key, counter, ctr, NULL, out, len, rounds);
+    }
+}
 
-        memcpy (inblock, in, len);
+static inline __attribute__ ((always_inline)) void
+state_keystream_rounds (const blabla_key *pk, const uint64_t *key, uint64_t *counter,
+                        uint8_t *out, uint64_t len, const int rounds)
+{
+    STATS_ENTER (keystream, len, BLABLA_ISA);
+    state_keystream_core (pk, key, counter, out, len, rounds);
+    STATS_EXIT (keystream, len);
+}
 
-        BLABLA_CORE (z0, z1, z2, z3, z4, z5, z6, z7,
-                     z8, z9,z10,z11,z12,z13,z14,z15,
-                     x0, x1, x2, x3, x4, x5, x6, x7,
-                     x8, x9,x10,x11,x12,x13,x14,x15);
-        BLABLA_XOR_OUT (inblock, outblock);
+static inline __attribute__ ((always_inline)) void
+ctxt_keystream_rounds (blabla_ctxt *ctxt, uint8_t *out, uint64_t len, const int rounds)
+{
+    state_keystream_rounds (NULL, ctxt->key, ctxt->counter, out, len, rounds);
+}
 
-        memcpy (out, outblock, len);
+void blabla_ctxt_keystream (blabla_ctxt *ctxt, uint8_t *out, uint64_t len)
+{
+    ctxt_keystream_rounds (ctxt, out, len, nROUNDS);
+}
+
+int blabla_keystream (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k)
+{
+    blabla_ctxt ctxt;
+    blabla_ctxt_init (&ctxt, k, n);
+    blabla_ctxt_keystream (&ctxt, out, outlen);
+    return 0;
+}
+
+#if defined(SUPERCOP) && !defined(BLABLA_IMPL)
+int crypto_stream (unsigned char *out,
+                   unsigned long long outlen,
+                   const unsigned char *n,
+                   const unsigned char *k)
+{
+    return blabla_keystream (out, outlen, n, k);
+}
+#endif
+
+static inline __attribute__ ((always_inline)) void
+state_xor_core (const blabla_key *pk, const uint64_t *key, uint64_t *counter,
+                const uint8_t *in, uint8_t *out, uint64_t len, const int rounds)
+{
+    MM_TYPE x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
+    MM_TYPE z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15;
+    MM_TYPE p0, p2, p3, p4, p6, p7, p8, p10, p11, p12, p14, p15;
+
+    uint64_t ctr = counter[1];
+
+    /* Advance the context past the blocks used by this call */
+    counter[1] += (len + BLOCK_LEN - 1) / BLOCK_LEN;
+
+    if (len <= BLOCKS_PER_CORE * BLOCK_LEN / 2)
+    {
+        STATS_TAIL (len);
+        blabla_tail (key, counter, ctr, in, out, len, rounds);
+        return;
+    }
+
+    if (pk != NULL)
+        BLABLA_INIT_KEY (x0, x1, x2, x3, x4, x5, x6, x7,
+                         x8, x9,x10,x11,x12,x13,x14,x15,
+                         pk, counter);
+    else
+        BLABLA_INIT (x0, x1, x2, x3, x4, x5, x6, x7,
+                     x8, x9,x10,x11,x12,x13,x14,x15,
+                     constants, key, counter);
+    x13 = SET1_EPI64x (ctr);
+
+    /* Increment counter */
+    x13 = ADD (x13, INIT_COUNTER);
+    BLABLA_PRECOMPUTE ();
+
+    if (len >= NT_THRESHOLD && IS_ALIGNED (out))
+    {
+        /* Aligned loads when in is aligned as well */
+        if (IS_ALIGNED (in))
+        {
+            BLABLA_XOR_NT_LOOP (LOADA);
+        }
+        else
+        {
+            BLABLA_XOR_NT_LOOP (LOADU);
+        }
+        STREAM_FENCE ();
+    }
+
+#ifdef HYBRID_CORES
+    while (len >= (BLOCKS_PER_CORE + 1) * BLOCK_LEN)
+    {
+        uint64_t s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11, s12, s13, s14, s15;
+
+        BLABLA_CORE_H (rounds);
+        BLABLA_XOR_OUT (in, out);
+        SCALAR_XOR_OUT (in + BLOCKS_PER_CORE * BLOCK_LEN, out + BLOCKS_PER_CORE * BLOCK_LEN);
+
+        x13 = ADD (x13, SET1_EPI64x (BLOCKS_PER_CORE + 1));
+        ctr += BLOCKS_PER_CORE + 1;
+
+        in += (BLOCKS_PER_CORE + 1) * BLOCK_LEN;
+        out += (BLOCKS_PER_CORE + 1) * BLOCK_LEN;
+        len -= (BLOCKS_PER_CORE + 1) * BLOCK_LEN;
+    }
+#endif
+
+#if defined(INTERLEAVE_CORES) && !defined(HYBRID_CORES)
+    while (len >= 2 * BLOCKS_PER_CORE * BLOCK_LEN)
+    {
+        MM_TYPE y0, y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15;
+
+        BLABLA_CORE2_P (rounds);
+        BLABLA_XOR_OUT (in, out);
+        BLABLA_NEXT_CORE ();
+        BLABLA_XOR_OUT (in + BLOCKS_PER_CORE * BLOCK_LEN, out + BLOCKS_PER_CORE * BLOCK_LEN);
+
+        x13 = ADD (x13, SET1_EPI64x (2 * BLOCKS_PER_CORE));
+        ctr += 2 * BLOCKS_PER_CORE;
+
+        in += 2 * BLOCKS_PER_CORE * BLOCK_LEN;
+        out += 2 * BLOCKS_PER_CORE * BLOCK_LEN;
+        len -= 2 * BLOCKS_PER_CORE * BLOCK_LEN;
+    }
+#endif
+
+    while (len >= BLOCKS_PER_CORE * BLOCK_LEN)
+    {
+        BLABLA_CORE_P (rounds);
+        BLABLA_XOR_OUT (in, out);
+
+        /* Increment counter */
+        x13 = ADD (x13, SET1_EPI64x (BLOCKS_PER_CORE));
+        ctr += BLOCKS_PER_CORE;
+
+        in += BLOCKS_PER_CORE * BLOCK_LEN;
+        out += BLOCKS_PER_CORE * BLOCK_LEN;
+        len -= BLOCKS_PER_CORE * BLOCK_LEN;
+    }
+
+    STATS_TAIL (len);
+    if (len > BLOCKS_PER_CORE * BLOCK_LEN / 2)
+    {
+        BLABLA_CORE_P (rounds);
+        BLABLA_TAIL_OUT (in, out, len);
+    }
+    else if (len > 0)
+    {
+        blabla_tail (key, counter, ctr, in, out, len, rounds);
     }
 }
 
+static inline __attribute__ ((always_inline)) void
+state_xor_rounds (const blabla_key *pk, const uint64_t *key, uint64_t *counter,
+                  const uint8_t *in, uint8_t *out, uint64_t len, const int rounds)
+{
+    STATS_ENTER (xor, len, BLABLA_ISA);
+    state_xor_core (pk, key, counter, in, out, len, rounds);
+    STATS_EXIT (xor, len);
+}
+
+static inline __attribute__ ((always_inline)) void
+ctxt_xor_rounds (blabla_ctxt *ctxt, const uint8_t *in, uint8_t *out, uint64_t len, const int rounds)
+{
+    state_xor_rounds (NULL, ctxt->key, ctxt->counter, in, out, len, rounds);
+}
+
+void blabla_ctxt_xor (blabla_ctxt *ctxt, const uint8_t *in, uint8_t *out, uint64_t len)
+{
+    ctxt_xor_rounds (ctxt, in, out, len, nROUNDS);
+}
+
 int blabla_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k)
 {
     blabla_ctxt ctxt;
@@ -502,7 +1701,26 @@ int blabla_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *
     return 0;
 }
 
-#ifdef SUPERCOP
+/* Only the counter and nonce are set up per message */
+int blabla_keystream_with_key (uint8_t *out, uint64_t outlen, const uint8_t *n, const blabla_key *key)
+{
+    uint64_t counter[4] = { constants[8], 1 };
+
+    memcpy (&counter[2], n, 16);
+    state_keystream_rounds (key, key->key, counter, out, outlen, nROUNDS);
+    return 0;
+}
+
+int blabla_xor_with_key (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const blabla_key *key)
+{
+    uint64_t counter[4] = { constants[8], 1 };
+
+    memcpy (&counter[2], n, 16);
+    state_xor_rounds (key, key->key, counter, in, out, inlen, nROUNDS);
+    return 0;
+}
+
+#if defined(SUPERCOP) && !defined(BLABLA_IMPL)
 int crypto_stream_xor (unsigned char *out,
                        const unsigned char *in,
                        unsigned long long inlen,
@@ -512,3 +1730,914 @@ int crypto_stream_xor (unsigned char *out,
     return blabla_xor (out, in, inlen, n, k);
 }
 #endif
+
+int blabla_keystream_rounds (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k, int rounds)
+{
+    blabla_ctxt ctxt;
+
+    blabla_ctxt_init (&ctxt, k, n);
+    switch (rounds)
+    {
+    case 6:
+        ctxt_keystream_rounds (&ctxt, out, outlen, 6);
+        break;
+    case 8:
+        ctxt_keystream_rounds (&ctxt, out, outlen, 8);
+        break;
+    case 10:
+        blabla_ctxt_keystream (&ctxt, out, outlen);
+        break;
+    case 12:
+        ctxt_keystream_rounds (&ctxt, out, outlen, 12);
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+int blabla_xor_rounds (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k, int rounds)
+{
+    blabla_ctxt ctxt;
+
+    blabla_ctxt_init (&ctxt, k, n);
+    switch (rounds)
+    {
+    case 6:
+        ctxt_xor_rounds (&ctxt, in, out, inlen, 6);
+        break;
+    case 8:
+        ctxt_xor_rounds (&ctxt, in, out, inlen, 8);
+        break;
+    case 10:
+        blabla_ctxt_xor (&ctxt, in, out, inlen);
+        break;
+    case 12:
+        ctxt_xor_rounds (&ctxt, in, out, inlen, 12);
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Keystream as doubles in [0, 1), converted in the registers between the
+ * transposition and the store. The end of the output is generated as bytes
+ * and converted in place.
+ */
+#define STORE_DOUBLE(m, v) STOREU (m, UNIT_DOUBLE (v))
+
+void blabla_ctxt_double (blabla_ctxt *ctxt, double *out, uint64_t n)
+{
+    MM_TYPE x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
+    MM_TYPE z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15;
+
+    uint8_t *dst = (uint8_t *)out;
+    uint64_t len = 8 * n;
+    uint64_t i;
+
+    BLABLA_INIT (x0, x1, x2, x3, x4, x5, x6, x7,
+                 x8, x9,x10,x11,x12,x13,x14,x15,
+                 constants, ctxt->key, ctxt->counter);
+    x13 = ADD (x13, INIT_COUNTER);
+
+#ifdef INTERLEAVE_CORES
+    while (len >= 2 * BLOCKS_PER_CORE * BLOCK_LEN)
+    {
+        MM_TYPE y0, y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15;
+
+        BLABLA_CORE2 (nROUNDS);
+        BLABLA_OUT_ (dst, STORE_DOUBLE);
+        BLABLA_NEXT_CORE ();
+        BLABLA_OUT_ (dst + BLOCKS_PER_CORE * BLOCK_LEN, STORE_DOUBLE);
+
+        x13 = ADD (x13, SET1_EPI64x (2 * BLOCKS_PER_CORE));
+        ctxt->counter[1] += 2 * BLOCKS_PER_CORE;
+
+        dst += 2 * BLOCKS_PER_CORE * BLOCK_LEN;
+        len -= 2 * BLOCKS_PER_CORE * BLOCK_LEN;
+    }
+#endif
+
+    while (len >= BLOCKS_PER_CORE * BLOCK_LEN)
+    {
+        BLABLA_CORE (z0, z1, z2, z3, z4, z5, z6, z7,
+                     z8, z9,z10,z11,z12,z13,z14,z15,
+                     x0, x1, x2, x3, x4, x5, x6, x7,
+                     x8, x9,x10,x11,x12,x13,x14,x15, nROUNDS);
+        BLABLA_OUT_ (dst, STORE_DOUBLE);
+
+        x13 = ADD (x13, SET1_EPI64x (BLOCKS_PER_CORE));
+        ctxt->counter[1] += BLOCKS_PER_CORE;
+
+        dst += BLOCKS_PER_CORE * BLOCK_LEN;
+        len -= BLOCKS_PER_CORE * BLOCK_LEN;
+    }
+
+    if (len > 0)
+    {
+        ctxt_keystream_rounds (ctxt, dst, len, nROUNDS);
+        for (i = 0; i < len; i += 8)
+        {
+            uint64_t w;
+            double d;
+
+            memcpy (&w, dst + i, 8);
+            d = blabla_unit_double (w);
+            memcpy (dst + i, &d, 8);
+        }
+    }
+}
+
+/*
+ * BlaBla-Poly1305 AEAD, fused: Poly1305 runs in the SIMD lanes on 26-bit
+ * limbs, one 16-byte block per lane. Lane j accumulates blocks j, j + L,
+ * j + 2L, ... by Horner's rule in r^L, and the lanes are recombined with
+ * r^L, ..., r^1 at the end. The ciphertext of each core is absorbed right
+ * after it is stored (before it is decrypted), while it is still in L1.
+ */
+#define POLY_LANES (MM_BITS / 64)
+#define POLY_GROUP (16 * POLY_LANES)
+#define POLY_CORE_GROUPS (BLOCKS_PER_CORE * BLOCK_LEN / POLY_GROUP)
+
+typedef struct
+{
+    MM_TYPE h[5];
+    MM_TYPE r[5], s[5];   /* r^L in every lane, s = 5 r */
+    MM_TYPE pr[5], ps[5]; /* r^(L - j) in lane j */
+    int started;
+    int ready;            /* r, s, pr and ps are set */
+} poly_vec;
+
+static inline __attribute__ ((always_inline)) void
+poly_vec_mulmod (MM_TYPE *h, const MM_TYPE *r, const MM_TYPE *s)
+{
+    const MM_TYPE mask = SET1_EPI64x (POLY1305_MASK);
+    MM_TYPE d0, d1, d2, d3, d4, c;
+
+    d0 = ADD (ADD (ADD (ADD (MUL32 (h[0], r[0]), MUL32 (h[1], s[4])), MUL32 (h[2], s[3])),
+                   MUL32 (h[3], s[2])), MUL32 (h[4], s[1]));
+    d1 = ADD (ADD (ADD (ADD (MUL32 (h[0], r[1]), MUL32 (h[1], r[0])), MUL32 (h[2], s[4])),
+                   MUL32 (h[3], s[3])), MUL32 (h[4], s[2]));
+    d2 = ADD (ADD (ADD (ADD (MUL32 (h[0], r[2]), MUL32 (h[1], r[1])), MUL32 (h[2], r[0])),
+                   MUL32 (h[3], s[4])), MUL32 (h[4], s[3]));
+    d3 = ADD (ADD (ADD (ADD (MUL32 (h[0], r[3]), MUL32 (h[1], r[2])), MUL32 (h[2], r[1])),
+                   MUL32 (h[3], r[0])), MUL32 (h[4], s[4]));
+    d4 = ADD (ADD (ADD (ADD (MUL32 (h[0], r[4]), MUL32 (h[1], r[3])), MUL32 (h[2], r[2])),
+                   MUL32 (h[3], r[1])), MUL32 (h[4], r[0]));
+
+    c = SHR64 (d0, 26);
+    h[0] = AND (d0, mask);
+    d1 = ADD (d1, c);
+    c = SHR64 (d1, 26);
+    h[1] = AND (d1, mask);
+    d2 = ADD (d2, c);
+    c = SHR64 (d2, 26);
+    h[2] = AND (d2, mask);
+    d3 = ADD (d3, c);
+    c = SHR64 (d3, 26);
+    h[3] = AND (d3, mask);
+    d4 = ADD (d4, c);
+    c = SHR64 (d4, 26);
+    h[4] = AND (d4, mask);
+    h[0] = ADD (h[0], ADD (c, SHL64 (c, 2)));
+    c = SHR64 (h[0], 26);
+    h[0] = AND (h[0], mask);
+    h[1] = ADD (h[1], c);
+}
+
+/* h += the next group of L blocks of m */
+#define POLY_ADD_GROUP(h, m)                                                   \
+    do                                                                         \
+    {                                                                          \
+        const MM_TYPE mask_ = SET1_EPI64x (POLY1305_MASK);                     \
+        MM_TYPE lo_, hi_;                                                      \
+                                                                               \
+        POLY_LOAD (m, lo_, hi_);                                               \
+        h[0] = ADD (h[0], AND (lo_, mask_));                                   \
+        h[1] = ADD (h[1], AND (SHR64 (lo_, 26), mask_));                       \
+        h[2] = ADD (h[2], AND (OR (SHR64 (lo_, 52), SHL64 (hi_, 12)), mask_)); \
+        h[3] = ADD (h[3], AND (SHR64 (hi_, 14), mask_));                       \
+        h[4] = ADD (h[4], OR (SHR64 (hi_, 40), SET1_EPI64x (1 << 24)));        \
+    } while (0)
+
+static void poly_vec_init (poly_vec *pv, const poly1305_state *st)
+{
+    uint32_t pow[POLY_LANES + 1][5];
+    uint64_t lanes[POLY_LANES];
+    int i, j;
+
+    memcpy (pow[1], st->r, sizeof (pow[1]));
+    for (j = 2; j <= POLY_LANES; ++j)
+    {
+        memcpy (pow[j], pow[j - 1], sizeof (pow[j]));
+        poly1305_mulmod (pow[j], st->r);
+    }
+
+    for (i = 0; i < 5; ++i)
+    {
+        pv->h[i] = SET1_EPI64x (0);
+        pv->r[i] = SET1_EPI64x (pow[POLY_LANES][i]);
+        pv->s[i] = SET1_EPI64x (5 * (uint64_t)pow[POLY_LANES][i]);
+        for (j = 0; j < POLY_LANES; ++j)
+            lanes[j] = pow[POLY_LANES - j][i];
+        pv->pr[i] = LOADU (lanes);
+        for (j = 0; j < POLY_LANES; ++j)
+            lanes[j] *= 5;
+        pv->ps[i] = LOADU (lanes);
+    }
+    pv->started = 0;
+    pv->ready = 1;
+}
+
+/* ngroups groups of L blocks. The scalar accumulator enters lane 0 with the
+ * first group, which is not multiplied by r^L. */
+static inline __attribute__ ((always_inline)) void
+poly_vec_blocks (poly_vec *pv, const poly1305_state *st, const uint8_t *m, uint64_t ngroups)
+{
+    MM_TYPE h[5];
+    int i;
+
+    if (ngroups == 0)
+        return;
+
+    if (!pv->started)
+    {
+        uint64_t lanes[POLY_LANES] = { 0 };
+
+        for (i = 0; i < 5; ++i)
+        {
+            lanes[0] = st->h[i];
+            h[i] = LOADU (lanes);
+        }
+        POLY_ADD_GROUP (h, m);
+        m += POLY_GROUP;
+        --ngroups;
+        pv->started = 1;
+    }
+    else
+    {
+        for (i = 0; i < 5; ++i)
+            h[i] = pv->h[i];
+    }
+
+    while (ngroups-- > 0)
+    {
+        poly_vec_mulmod (h, pv->r, pv->s);
+        POLY_ADD_GROUP (h, m);
+        m += POLY_GROUP;
+    }
+
+    for (i = 0; i < 5; ++i)
+        pv->h[i] = h[i];
+}
+
+/* Back to the scalar accumulator */
+static void poly_vec_final (poly_vec *pv, poly1305_state *st)
+{
+    uint64_t lanes[POLY_LANES];
+    uint64_t t[5], c;
+    int i, j;
+
+    if (!pv->started)
+        return;
+
+    poly_vec_mulmod (pv->h, pv->pr, pv->ps);
+    for (i = 0; i < 5; ++i)
+    {
+        STOREU (lanes, pv->h[i]);
+        t[i] = 0;
+        for (j = 0; j < POLY_LANES; ++j)
+            t[i] += lanes[j];
+    }
+
+    c = t[0] >> 26;
+    t[0] &= POLY1305_MASK;
+    t[1] += c;
+    c = t[1] >> 26;
+    t[1] &= POLY1305_MASK;
+    t[2] += c;
+    c = t[2] >> 26;
+    t[2] &= POLY1305_MASK;
+    t[3] += c;
+    c = t[3] >> 26;
+    t[3] &= POLY1305_MASK;
+    t[4] += c;
+    c = t[4] >> 26;
+    t[4] &= POLY1305_MASK;
+    t[0] += c * 5;
+    c = t[0] >> 26;
+    t[0] &= POLY1305_MASK;
+    t[1] += c;
+
+    for (i = 0; i < 5; ++i)
+        st->h[i] = t[i];
+    pv->started = 0;
+}
+
+/* Zero-padded data, as poly1305_padded. The powers of r in pv are computed
+ * on first use and kept for the message. */
+static void aead_padded (poly_vec *pv, poly1305_state *st, const uint8_t *m, uint64_t len)
+{
+    uint64_t ngroups = len / POLY_GROUP;
+
+    if (ngroups > 0)
+    {
+        if (!pv->ready)
+            poly_vec_init (pv, st);
+        poly_vec_blocks (pv, st, m, ngroups);
+        poly_vec_final (pv, st);
+    }
+    poly1305_padded (st, m + ngroups * POLY_GROUP, len - ngroups * POLY_GROUP);
+}
+
+/* The Poly1305 key is the start of block 0. Messages of at most one block
+ * get their keystream ks from the same call, which computes both blocks with
+ * one 2-block kernel. */
+static void aead_init (blabla_ctxt *ctxt, poly1305_state *st, uint8_t *ks, uint64_t len,
+                       const uint8_t *n, const uint8_t *k)
+{
+    uint8_t block[2 * BLOCK_LEN];
+
+    blabla_ctxt_init (ctxt, k, n);
+    ctxt->counter[1] = 0;
+    blabla_ctxt_keystream (ctxt, block, len <= BLOCK_LEN ? BLOCK_LEN + len : 32);
+    poly1305_init (st, block);
+    if (len <= BLOCK_LEN)
+        memcpy (ks, block + BLOCK_LEN, len);
+    blabla_wipe (block, sizeof (block));
+}
+
+/* Encrypts or decrypts in to out from block 1, and absorbs the ciphertext */
+static inline __attribute__ ((always_inline)) void
+aead_xor (blabla_ctxt *ctxt, poly_vec *pv, poly1305_state *st, const uint8_t *in, uint8_t *out,
+          uint64_t len, const int decrypt)
+{
+    MM_TYPE x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
+    MM_TYPE z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15;
+
+    if (len >= BLOCKS_PER_CORE * BLOCK_LEN)
+    {
+        if (!pv->ready)
+            poly_vec_init (pv, st);
+        BLABLA_INIT (x0, x1, x2, x3, x4, x5, x6, x7,
+                     x8, x9,x10,x11,x12,x13,x14,x15,
+                     constants, ctxt->key, ctxt->counter);
+        x13 = ADD (x13, INIT_COUNTER);
+
+#ifdef INTERLEAVE_CORES
+        while (len >= 2 * BLOCKS_PER_CORE * BLOCK_LEN)
+        {
+            MM_TYPE y0, y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15;
+
+            if (decrypt)
+                poly_vec_blocks (pv, st, in, 2 * POLY_CORE_GROUPS);
+            BLABLA_CORE2 (nROUNDS);
+            BLABLA_XOR_OUT (in, out);
+            BLABLA_NEXT_CORE ();
+            BLABLA_XOR_OUT (in + BLOCKS_PER_CORE * BLOCK_LEN, out + BLOCKS_PER_CORE * BLOCK_LEN);
+            if (!decrypt)
+                poly_vec_blocks (pv, st, out, 2 * POLY_CORE_GROUPS);
+
+            x13 = ADD (x13, SET1_EPI64x (2 * BLOCKS_PER_CORE));
+            ctxt->counter[1] += 2 * BLOCKS_PER_CORE;
+
+            in += 2 * BLOCKS_PER_CORE * BLOCK_LEN;
+            out += 2 * BLOCKS_PER_CORE * BLOCK_LEN;
+            len -= 2 * BLOCKS_PER_CORE * BLOCK_LEN;
+        }
+#endif
+
+        while (len >= BLOCKS_PER_CORE * BLOCK_LEN)
+        {
+            if (decrypt)
+                poly_vec_blocks (pv, st, in, POLY_CORE_GROUPS);
+            BLABLA_CORE (z0, z1, z2, z3, z4, z5, z6, z7,
+                         z8, z9,z10,z11,z12,z13,z14,z15,
+                         x0, x1, x2, x3, x4, x5, x6, x7,
+                         x8, x9,x10,x11,x12,x13,x14,x15, nROUNDS);
+            BLABLA_XOR_OUT (in, out);
+            if (!decrypt)
+                poly_vec_blocks (pv, st, out, POLY_CORE_GROUPS);
+
+            x13 = ADD (x13, SET1_EPI64x (BLOCKS_PER_CORE));
+            ctxt->counter[1] += BLOCKS_PER_CORE;
+
+            in += BLOCKS_PER_CORE * BLOCK_LEN;
+            out += BLOCKS_PER_CORE * BLOCK_LEN;
+            len -= BLOCKS_PER_CORE * BLOCK_LEN;
+        }
+
+        poly_vec_final (pv, st);
+    }
+
+    if (len > 0)
+    {
+        if (decrypt)
+            poly1305_padded (st, in, len);
+        blabla_ctxt_xor (ctxt, in, out, len);
+        if (!decrypt)
+            poly1305_padded (st, out, len);
+    }
+}
+
+int blabla_aead_encrypt (uint8_t *c, uint8_t *tag, const uint8_t *m, uint64_t mlen,
+                         const uint8_t *ad, uint64_t adlen, const uint8_t *n, const uint8_t *k)
+{
+    blabla_ctxt ctxt;
+    poly1305_state st;
+    uint8_t ks[BLOCK_LEN];
+    poly_vec pv;
+    uint64_t i;
+
+    aead_init (&ctxt, &st, ks, mlen, n, k);
+    pv.ready = 0;
+    aead_padded (&pv, &st, ad, adlen);
+    if (mlen <= BLOCK_LEN)
+    {
+        for (i = 0; i < mlen; ++i)
+            c[i] = m[i] ^ ks[i];
+        poly1305_padded (&st, c, mlen);
+    }
+    else
+    {
+        aead_xor (&ctxt, &pv, &st, m, c, mlen, 0);
+    }
+    poly1305_lengths (&st, adlen, mlen);
+    poly1305_finish (&st, tag);
+    blabla_wipe (&ctxt, sizeof (ctxt));
+    blabla_wipe (ks, sizeof (ks));
+    if (pv.ready)
+        blabla_wipe (&pv, sizeof (pv));
+    return 0;
+}
+
+/* Verifies and decrypts in the same pass, then wipes m if the tag is wrong */
+int blabla_aead_decrypt (uint8_t *m, const uint8_t *c, uint64_t clen, const uint8_t *tag,
+                         const uint8_t *ad, uint64_t adlen, const uint8_t *n, const uint8_t *k)
+{
+    blabla_ctxt ctxt;
+    poly1305_state st;
+    uint8_t computed[16];
+    uint8_t ks[BLOCK_LEN];
+    poly_vec pv;
+    uint64_t i;
+
+    aead_init (&ctxt, &st, ks, clen, n, k);
+    pv.ready = 0;
+    aead_padded (&pv, &st, ad, adlen);
+    if (clen <= BLOCK_LEN)
+    {
+        poly1305_padded (&st, c, clen);
+        for (i = 0; i < clen; ++i)
+            m[i] = c[i] ^ ks[i];
+    }
+    else
+    {
+        aead_xor (&ctxt, &pv, &st, c, m, clen, 1);
+    }
+    poly1305_lengths (&st, adlen, clen);
+    poly1305_finish (&st, computed);
+    blabla_wipe (&ctxt, sizeof (ctxt));
+    blabla_wipe (ks, sizeof (ks));
+    if (pv.ready)
+        blabla_wipe (&pv, sizeof (pv));
+
+    if (poly1305_verify (computed, tag) != 0)
+    {
+        blabla_wipe (computed, sizeof (computed));
+        memset (m, 0, clen);
+        return -1;
+    }
+    blabla_wipe (computed, sizeof (computed));
+    return 0;
+}
+
+/*
+ * Multi-buffer API: every lane of the core carries a different message, with
+ * its own key, nonce and counter. Lanes are refilled from the job list as
+ * messages finish; once the list is empty, the messages left in the lanes
+ * are finished with blabla_ctxt_xor.
+ */
+
+typedef struct
+{
+    uint64_t key[4][BLOCKS_PER_CORE];
+    uint64_t counter[BLOCKS_PER_CORE];
+    uint64_t nonce[2][BLOCKS_PER_CORE];
+    const blabla_job *job[BLOCKS_PER_CORE];
+    uint64_t pos[BLOCKS_PER_CORE];
+} batch_lanes;
+
+/* Loads the next non-empty job into lane j, returns 0 if there is none */
+static int batch_fill (batch_lanes *lanes, int j, const blabla_job *jobs, uint64_t count, uint64_t *next)
+{
+    uint64_t w[6];
+    int i;
+
+    while (*next < count && jobs[*next].len == 0)
+        ++*next;
+    if (*next == count)
+    {
+        lanes->job[j] = NULL;
+        return 0;
+    }
+
+    lanes->job[j] = &jobs[*next];
+    ++*next;
+    memcpy (w, lanes->job[j]->key, 32);
+    memcpy (w + 4, lanes->job[j]->nonce, 16);
+    for (i = 0; i < 4; ++i)
+        lanes->key[i][j] = w[i];
+    lanes->nonce[0][j] = w[4];
+    lanes->nonce[1][j] = w[5];
+    lanes->counter[j] = 1;
+    lanes->pos[j] = 0;
+    return 1;
+}
+
+static inline void lane_xor_block (const uint8_t *in, uint8_t *out, const uint8_t *ks, uint64_t len)
+{
+    uint64_t i;
+
+    if (len == BLOCK_LEN)
+    {
+        for (i = 0; i < BLOCK_LEN; i += MM_BITS / 8)
+            STOREU (out + i, XOR (LOADU (ks + i), LOADU (in + i)));
+        return;
+    }
+    for (i = 0; i < len; ++i)
+        out[i] = in[i] ^ ks[i];
+}
+
+int blabla_xor_batch (const blabla_job *jobs, uint64_t count)
+{
+    MM_TYPE x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
+    MM_TYPE z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15;
+
+    batch_lanes lanes;
+    uint8_t ks[BLOCKS_PER_CORE * BLOCK_LEN];
+    uint64_t next = 0;
+    int active = 0;
+    int j;
+
+    for (j = 0; j < BLOCKS_PER_CORE; ++j)
+        active += batch_fill (&lanes, j, jobs, count, &next);
+
+    x0 = SET1_EPI64x (constants[0]);
+    x1 = SET1_EPI64x (constants[1]);
+    x2 = SET1_EPI64x (constants[2]);
+    x3 = SET1_EPI64x (constants[3]);
+    x8 = SET1_EPI64x (constants[4]);
+    x9 = SET1_EPI64x (constants[5]);
+    x10 = SET1_EPI64x (constants[6]);
+    x11 = SET1_EPI64x (constants[7]);
+    x12 = SET1_EPI64x (constants[8]);
+
+    /* One block of each message per core, as long as all lanes are busy */
+    while (active == BLOCKS_PER_CORE)
+    {
+        x4 = LOADU (lanes.key[0]);
+        x5 = LOADU (lanes.key[1]);
+        x6 = LOADU (lanes.key[2]);
+        x7 = LOADU (lanes.key[3]);
+        x13 = LOADU (lanes.counter);
+        x14 = LOADU (lanes.nonce[0]);
+        x15 = LOADU (lanes.nonce[1]);
+
+        BLABLA_CORE (z0, z1, z2, z3, z4, z5, z6, z7,
+                     z8, z9,z10,z11,z12,z13,z14,z15,
+                     x0, x1, x2, x3, x4, x5, x6, x7,
+                     x8, x9,x10,x11,x12,x13,x14,x15, nROUNDS);
+        BLABLA_OUT (ks);
+
+        for (j = 0; j < BLOCKS_PER_CORE; ++j)
+        {
+            const blabla_job *job = lanes.job[j];
+            uint64_t pos = lanes.pos[j];
+            uint64_t n = job->len - pos < BLOCK_LEN ? job->len - pos : BLOCK_LEN;
+
+            lane_xor_block (job->in + pos, job->out + pos, ks + j * BLOCK_LEN, n);
+            lanes.pos[j] = pos + n;
+            ++lanes.counter[j];
+            if (lanes.pos[j] == job->len)
+                active -= !batch_fill (&lanes, j, jobs, count, &next);
+        }
+    }
+
+    /* The job list is empty: finish what is left in the lanes */
+    for (j = 0; j < BLOCKS_PER_CORE; ++j)
+    {
+        const blabla_job *job = lanes.job[j];
+        blabla_ctxt ctxt;
+        uint64_t pos;
+
+        if (job == NULL)
+            continue;
+        pos = lanes.pos[j];
+        blabla_ctxt_init (&ctxt, job->key, job->nonce);
+        ctxt.counter[1] = lanes.counter[j];
+        blabla_ctxt_xor (&ctxt, job->in + pos, job->out + pos, job->len - pos);
+    }
+
+    return 0;
+}
+
+/* After TRANSPOSE, block j of the core is made of vectors
+ * j * LANE_VECS .. (j + 1) * LANE_VECS - 1, and goes to dst + j * stride */
+#define LANE_VECS (8 * BLOCK_LEN / MM_BITS)
+
+#define SECTOR_XOR_STORE(dst, stride, z, i)                                    \
+    do                                                                         \
+    {                                                                          \
+        uint8_t *p_ = dst + (i / LANE_VECS) * stride + (i % LANE_VECS) * (MM_BITS / 8); \
+        STOREU (p_, XOR (z ## i, LOADU (p_)));                                 \
+    } while (0)
+
+#define SECTOR_XOR_OUT(dst, stride)                                                       \
+    do                                                                                    \
+    {                                                                                     \
+        TRANSPOSE (z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15); \
+        SECTOR_XOR_STORE (dst, stride, z, 0);                                             \
+        SECTOR_XOR_STORE (dst, stride, z, 1);                                             \
+        SECTOR_XOR_STORE (dst, stride, z, 2);                                             \
+        SECTOR_XOR_STORE (dst, stride, z, 3);                                             \
+        SECTOR_XOR_STORE (dst, stride, z, 4);                                             \
+        SECTOR_XOR_STORE (dst, stride, z, 5);                                             \
+        SECTOR_XOR_STORE (dst, stride, z, 6);                                             \
+        SECTOR_XOR_STORE (dst, stride, z, 7);                                             \
+        SECTOR_XOR_STORE (dst, stride, z, 8);                                             \
+        SECTOR_XOR_STORE (dst, stride, z, 9);                                             \
+        SECTOR_XOR_STORE (dst, stride, z, 10);                                            \
+        SECTOR_XOR_STORE (dst, stride, z, 11);                                            \
+        SECTOR_XOR_STORE (dst, stride, z, 12);                                            \
+        SECTOR_XOR_STORE (dst, stride, z, 13);                                            \
+        SECTOR_XOR_STORE (dst, stride, z, 14);                                            \
+        SECTOR_XOR_STORE (dst, stride, z, 15);                                            \
+    } while (0)
+
+/*
+ * Sectors of a same size under one key, with the sector index as nonce: each
+ * lane carries a different sector, all lanes use the same block counter.
+ * Sectors left over after the last full group go through blabla_ctxt_xor.
+ */
+int blabla_xor_sectors (uint8_t *buf, uint64_t nsectors, uint64_t sector_size, uint64_t first_index, const uint8_t *k)
+{
+    MM_TYPE x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
+    MM_TYPE z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15;
+
+    blabla_ctxt ctxt;
+    uint8_t ks[BLOCKS_PER_CORE * BLOCK_LEN];
+    uint64_t s, off;
+    int j;
+
+    blabla_ctxt_init_zero (&ctxt, k);
+    BLABLA_INIT (x0, x1, x2, x3, x4, x5, x6, x7,
+                 x8, x9,x10,x11,x12,x13,x14,x15,
+                 constants, ctxt.key, ctxt.counter);
+    x14 = ADD (SET1_EPI64x (first_index), INIT_COUNTER);
+
+    for (s = 0; s + BLOCKS_PER_CORE <= nsectors; s += BLOCKS_PER_CORE)
+    {
+        uint8_t *sector = buf + s * sector_size;
+
+        x13 = SET1_EPI64x (1);
+        for (off = 0; off < sector_size; off += BLOCK_LEN)
+        {
+            uint64_t n = sector_size - off < BLOCK_LEN ? sector_size - off : BLOCK_LEN;
+
+            BLABLA_CORE (z0, z1, z2, z3, z4, z5, z6, z7,
+                         z8, z9,z10,z11,z12,z13,z14,z15,
+                         x0, x1, x2, x3, x4, x5, x6, x7,
+                         x8, x9,x10,x11,x12,x13,x14,x15, nROUNDS);
+            if (n == BLOCK_LEN)
+            {
+                SECTOR_XOR_OUT (sector + off, sector_size);
+            }
+            else
+            {
+                BLABLA_OUT (ks);
+                for (j = 0; j < BLOCKS_PER_CORE; ++j)
+                    lane_xor_block (sector + j * sector_size + off, sector + j * sector_size + off,
+                                    ks + j * BLOCK_LEN, n);
+            }
+
+            x13 = ADD (x13, SET1_EPI64x (1));
+        }
+
+        x14 = ADD (x14, SET1_EPI64x (BLOCKS_PER_CORE));
+    }
+
+    for (; s < nsectors; ++s)
+    {
+        uint8_t *sector = buf + s * sector_size;
+
+        ctxt.counter[1] = 1;
+        ctxt.counter[2] = first_index + s;
+        blabla_ctxt_xor (&ctxt, sector, sector, sector_size);
+    }
+
+    return 0;
+}
+
+/* Vector i of the core from/to p + i * stride words */
+#define SOA_LOAD(p, stride)                                                    \
+    do                                                                         \
+    {                                                                          \
+        x0 = LOADU ((p) + 0 * (stride));                                       \
+        x1 = LOADU ((p) + 1 * (stride));                                       \
+        x2 = LOADU ((p) + 2 * (stride));                                       \
+        x3 = LOADU ((p) + 3 * (stride));                                       \
+        x4 = LOADU ((p) + 4 * (stride));                                       \
+        x5 = LOADU ((p) + 5 * (stride));                                       \
+        x6 = LOADU ((p) + 6 * (stride));                                       \
+        x7 = LOADU ((p) + 7 * (stride));                                       \
+        x8 = LOADU ((p) + 8 * (stride));                                       \
+        x9 = LOADU ((p) + 9 * (stride));                                       \
+        x10 = LOADU ((p) + 10 * (stride));                                     \
+        x11 = LOADU ((p) + 11 * (stride));                                     \
+        x12 = LOADU ((p) + 12 * (stride));                                     \
+        x13 = LOADU ((p) + 13 * (stride));                                     \
+        x14 = LOADU ((p) + 14 * (stride));                                     \
+        x15 = LOADU ((p) + 15 * (stride));                                     \
+    } while (0)
+
+#define SOA_STORE(p, stride)                                                   \
+    do                                                                         \
+    {                                                                          \
+        STOREU ((p) + 0 * (stride), z0);                                       \
+        STOREU ((p) + 1 * (stride), z1);                                       \
+        STOREU ((p) + 2 * (stride), z2);                                       \
+        STOREU ((p) + 3 * (stride), z3);                                       \
+        STOREU ((p) + 4 * (stride), z4);                                       \
+        STOREU ((p) + 5 * (stride), z5);                                       \
+        STOREU ((p) + 6 * (stride), z6);                                       \
+        STOREU ((p) + 7 * (stride), z7);                                       \
+        STOREU ((p) + 8 * (stride), z8);                                       \
+        STOREU ((p) + 9 * (stride), z9);                                       \
+        STOREU ((p) + 10 * (stride), z10);                                     \
+        STOREU ((p) + 11 * (stride), z11);                                     \
+        STOREU ((p) + 12 * (stride), z12);                                     \
+        STOREU ((p) + 13 * (stride), z13);                                     \
+        STOREU ((p) + 14 * (stride), z14);                                     \
+        STOREU ((p) + 15 * (stride), z15);                                     \
+    } while (0)
+
+/*
+ * Generic permutation, one state per lane. Full groups of SoA states are
+ * loaded and stored as they are. AoS states are gathered into lanes, and
+ * written back by TRANSPOSE, which turns lanes into consecutive blocks. A
+ * partial group of either layout goes through the lanes buffer both ways.
+ */
+void blabla_permute (uint64_t *states, uint64_t count, int flags)
+{
+    MM_TYPE x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
+    MM_TYPE z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15;
+
+    const int soa = (flags & BLABLA_PERMUTE_SOA) != 0;
+    uint64_t lanes[16][BLOCKS_PER_CORE];
+    uint64_t s, j;
+    int i;
+
+    for (s = 0; s < count; s += BLOCKS_PER_CORE)
+    {
+        uint64_t m = count - s < BLOCKS_PER_CORE ? count - s : BLOCKS_PER_CORE;
+
+        if (soa && m == BLOCKS_PER_CORE)
+        {
+            SOA_LOAD (states + s, count);
+        }
+        else
+        {
+            if (m < BLOCKS_PER_CORE)
+                memset (lanes, 0, sizeof (lanes));
+            for (i = 0; i < 16; ++i)
+                for (j = 0; j < m; ++j)
+                    lanes[i][j] = soa ? states[i * count + s + j] : states[16 * (s + j) + i];
+            SOA_LOAD (&lanes[0][0], BLOCKS_PER_CORE);
+        }
+
+        z0 = x0, z1 = x1, z2 = x2, z3 = x3, z4 = x4, z5 = x5, z6 = x6, z7 = x7;
+        z8 = x8, z9 = x9, z10 = x10, z11 = x11, z12 = x12, z13 = x13, z14 = x14, z15 = x15;
+        for (i = 0; i < nROUNDS; ++i)
+            DOUBLE_ROUND (z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15);
+        if (flags & BLABLA_PERMUTE_FEEDFORWARD)
+        {
+            z0 = ADD (x0, z0), z1 = ADD (x1, z1), z2 = ADD (x2, z2), z3 = ADD (x3, z3);
+            z4 = ADD (x4, z4), z5 = ADD (x5, z5), z6 = ADD (x6, z6), z7 = ADD (x7, z7);
+            z8 = ADD (x8, z8), z9 = ADD (x9, z9), z10 = ADD (x10, z10), z11 = ADD (x11, z11);
+            z12 = ADD (x12, z12), z13 = ADD (x13, z13), z14 = ADD (x14, z14), z15 = ADD (x15, z15);
+        }
+
+        if (m == BLOCKS_PER_CORE)
+        {
+            if (soa)
+                SOA_STORE (states + s, count);
+            else
+                BLABLA_OUT ((uint8_t *)(states + 16 * s));
+        }
+        else
+        {
+            SOA_STORE (&lanes[0][0], BLOCKS_PER_CORE);
+            for (i = 0; i < 16; ++i)
+                for (j = 0; j < m; ++j)
+                {
+                    if (soa)
+                        states[i * count + s + j] = lanes[i][j];
+                    else
+                        states[16 * (s + j) + i] = lanes[i][j];
+                }
+        }
+    }
+}
+
+/*
+ * HBlaBla, one input per lane: the key and constants are the same in all
+ * lanes and only x14, x15 differ. The rounds run without the final addition,
+ * then TRANSPOSE puts the first row of lane j at the start of block j.
+ *
+ * A single input left over goes through the one-block kernel instead: the
+ * final addition only adds constants[0..3] to the first row, which is taken
+ * back out.
+ */
+void hblabla_batch (uint8_t *out, const uint8_t *in, uint64_t count, const uint8_t *k)
+{
+    MM_TYPE x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
+    MM_TYPE z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15;
+
+    blabla_ctxt ctxt;
+    uint64_t nonce[2][BLOCKS_PER_CORE];
+    uint8_t ks[BLOCKS_PER_CORE * BLOCK_LEN];
+    uint64_t s;
+    int i, j;
+
+    blabla_ctxt_init_zero (&ctxt, k);
+    ctxt.counter[0] = ~constants[8];
+    ctxt.counter[1] = 0;
+    BLABLA_INIT (x0, x1, x2, x3, x4, x5, x6, x7,
+                 x8, x9,x10,x11,x12,x13,x14,x15,
+                 constants, ctxt.key, ctxt.counter);
+
+    for (s = 0; s + 1 < count; s += BLOCKS_PER_CORE)
+    {
+        uint64_t m = count - s < BLOCKS_PER_CORE ? count - s : BLOCKS_PER_CORE;
+
+        /* Lanes past the last input repeat it */
+        for (j = 0; j < BLOCKS_PER_CORE; ++j)
+        {
+            uint64_t w[2];
+
+            memcpy (w, in + 16 * (s + ((uint64_t)j < m ? (uint64_t)j : m - 1)), 16);
+            nonce[0][j] = w[0];
+            nonce[1][j] = w[1];
+        }
+        x14 = LOADU (nonce[0]);
+        x15 = LOADU (nonce[1]);
+
+        z0 = x0, z1 = x1, z2 = x2, z3 = x3, z4 = x4, z5 = x5, z6 = x6, z7 = x7;
+        z8 = x8, z9 = x9, z10 = x10, z11 = x11, z12 = x12, z13 = x13, z14 = x14, z15 = x15;
+        for (i = 0; i < nROUNDS; ++i)
+            DOUBLE_ROUND (z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15);
+        BLABLA_OUT (ks);
+
+        for (j = 0; (uint64_t)j < m; ++j)
+            memcpy (out + 32 * (s + j), ks + j * BLOCK_LEN, 32);
+    }
+
+    if (s < count)
+    {
+        uint64_t w[4];
+
+        memcpy (&ctxt.counter[2], in + 16 * s, 16);
+        blabla_block (ctxt.key, ctxt.counter, 0, NULL, (uint8_t *)w, 32, nROUNDS);
+        for (i = 0; i < 4; ++i)
+            w[i] -= constants[i];
+        memcpy (out + 32 * s, w, 32);
+    }
+}
+
+#ifdef BLABLA_IMPL
+#include "dispatch.h"
+
+const blabla_backend BLABLA_NAME (blabla_backend) = {
+    BLABLA_ISA,
+    blabla_ctxt_init,
+    blabla_ctxt_init_zero,
+    blabla_ctxt_keystream,
+    blabla_ctxt_xor,
+    blabla_keystream,
+    blabla_xor,
+    blabla_xor_batch,
+    blabla_xor_sectors,
+    blabla_keystream_rounds,
+    blabla_xor_rounds,
+    blabla_ctxt_double,
+    blabla_aead_encrypt,
+    blabla_aead_decrypt,
+    hblabla_batch,
+    blabla_permute,
+    blabla_keystream_with_key,
+    blabla_xor_with_key,
+};
+#endif
@@ -0,0 +1,26 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+#include "blabla.h"
+#include "poly1305.h"
+
+
+void blabla_poly1305 (uint8_t *tag, const uint8_t *m, uint64_t len, const uint8_t *key)
+{
+    poly1305_state st;
+
+    poly1305_init (&st, key);
+    poly1305_blocks (&st, m, len / 16, 1 << 24);
+    if (len % 16 != 0)
+    {
+        uint8_t block[16] = { 0 };
+
+        memcpy (block, m + len - len % 16, len % 16);
+        block[len % 16] = 1;
+        poly1305_blocks (&st, block, 1, 0);
+    }
+    poly1305_finish (&st, tag);
+}
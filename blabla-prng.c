@@ -0,0 +1,152 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+/*
+ * Deterministic generator over blabla_ctxt. Single draws are served from a
+ * buffer of one core of keystream; bulk fills go straight from the SIMD code
+ * to the output array once the buffer is drained.
+ */
+
+#include "blabla.h"
+
+#define PRNG_WORDS (BLABLA_STREAM_BUFLEN / 8)
+#define BLOCK_WORDS (BLOCK_LEN / 8)
+
+__extension__ typedef unsigned __int128 prng_u128;
+
+
+void blabla_prng_init (blabla_prng *rng, const uint8_t *seed, uint64_t stream)
+{
+    uint64_t nonce[2] = { stream, 0 };
+
+    blabla_ctxt_init (&rng->ctxt, seed, (const uint8_t *)nonce);
+    rng->pos = 0;
+    rng->len = 0;
+}
+
+static void prng_refill (blabla_prng *rng)
+{
+    blabla_ctxt_keystream (&rng->ctxt, (uint8_t *)rng->buf, sizeof (rng->buf));
+    rng->pos = 0;
+    rng->len = PRNG_WORDS;
+}
+
+void blabla_prng_jump (blabla_prng *rng, uint64_t nwords)
+{
+    uint64_t left = rng->len - rng->pos;
+
+    if (nwords <= left)
+    {
+        rng->pos += nwords;
+        return;
+    }
+
+    /* The counter is the index of the block after the buffered ones */
+    nwords -= left;
+    rng->ctxt.counter[1] += nwords / BLOCK_WORDS;
+    rng->pos = 0;
+    rng->len = 0;
+    if (nwords % BLOCK_WORDS != 0)
+    {
+        blabla_ctxt_keystream (&rng->ctxt, (uint8_t *)rng->buf, BLOCK_LEN);
+        rng->pos = nwords % BLOCK_WORDS;
+        rng->len = BLOCK_WORDS;
+    }
+}
+
+uint64_t blabla_prng_u64 (blabla_prng *rng)
+{
+    if (rng->pos == rng->len)
+        prng_refill (rng);
+    return rng->buf[rng->pos++];
+}
+
+double blabla_prng_double (blabla_prng *rng)
+{
+    return blabla_unit_double (blabla_prng_u64 (rng));
+}
+
+/* Lemire, "Fast random integer generation in an interval" (2019) */
+static inline uint64_t prng_lemire (blabla_prng *rng, uint64_t x, uint64_t range)
+{
+    prng_u128 m = (prng_u128)x * range;
+    uint64_t l = (uint64_t)m;
+
+    if (l < range)
+    {
+        uint64_t t = -range % range;
+
+        while (l < t)
+        {
+            m = (prng_u128)blabla_prng_u64 (rng) * range;
+            l = (uint64_t)m;
+        }
+    }
+    return (uint64_t)(m >> 64);
+}
+
+uint64_t blabla_prng_bounded (blabla_prng *rng, uint64_t range)
+{
+    return prng_lemire (rng, blabla_prng_u64 (rng), range);
+}
+
+static inline void prng_fill (blabla_prng *rng, uint64_t *out, double *dout, uint64_t n)
+{
+    uint64_t i = 0;
+
+    while (i < n)
+    {
+        uint64_t m, j;
+
+        if (rng->pos == rng->len)
+        {
+            /* Whole blocks straight into the output */
+            if (n - i >= PRNG_WORDS)
+            {
+                m = (n - i) - (n - i) % BLOCK_WORDS;
+                if (dout != NULL)
+                    blabla_ctxt_double (&rng->ctxt, dout + i, m);
+                else
+                    blabla_ctxt_keystream (&rng->ctxt, (uint8_t *)(out + i), 8 * m);
+                i += m;
+                continue;
+            }
+            prng_refill (rng);
+        }
+
+        m = rng->len - rng->pos < n - i ? rng->len - rng->pos : n - i;
+        if (dout != NULL)
+        {
+            for (j = 0; j < m; ++j)
+                dout[i + j] = blabla_unit_double (rng->buf[rng->pos + j]);
+        }
+        else
+        {
+            memcpy (out + i, rng->buf + rng->pos, 8 * m);
+        }
+        rng->pos += m;
+        i += m;
+    }
+}
+
+void blabla_prng_fill_u64 (blabla_prng *rng, uint64_t *out, uint64_t n)
+{
+    prng_fill (rng, out, NULL, n);
+}
+
+void blabla_prng_fill_double (blabla_prng *rng, double *out, uint64_t n)
+{
+    prng_fill (rng, NULL, out, n);
+}
+
+void blabla_prng_fill_bounded (blabla_prng *rng, uint64_t *out, uint64_t n, uint64_t range)
+{
+    uint64_t i;
+
+    prng_fill (rng, out, NULL, n);
+    for (i = 0; i < n; ++i)
+        out[i] = prng_lemire (rng, out[i], range);
+}
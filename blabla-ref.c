@@ -9,30 +9,31 @@
 #endif
 
 #include "blabla.h"
-
-typedef struct
-{
-    uint64_t key[4];
-    uint64_t counter[4];
-    uint64_t v[16];
-} blabla_ctxt;
-
+#include "poly1305.h"
+#include "stats.h"
 
 #define ROTR64(word, count) (((word) >> (count)) ^ ((word) << (64 - (count))))
 
 
+const char *blabla_backend_name (void)
+{
+    return "ref";
+}
+
 void blabla_ctxt_init (blabla_ctxt *ctxt, const uint8_t *key, const uint8_t *nonce)
 {
     memcpy (ctxt->key, key, 32);
-    ctxt->counter[0] = 1;
-    memcpy (&ctxt->counter[1], nonce, 16);
+    ctxt->counter[0] = constants[8];
+    ctxt->counter[1] = 1;
+    memcpy (&ctxt->counter[2], nonce, 16);
 }
 
 void blabla_ctxt_init_zero (blabla_ctxt *ctxt, const uint8_t *key)
 {
     memcpy (ctxt->key, key, 32);
-    ctxt->counter[0] = 1;
-    memset (&ctxt->counter[1], 0, 16);
+    ctxt->counter[0] = constants[8];
+    ctxt->counter[1] = 1;
+    memset (&ctxt->counter[2], 0, 16);
 }
 
 void G (uint64_t *v, int a, int b, int c, int d)
@@ -51,13 +52,11 @@ void G (uint64_t *v, int a, int b, int c, int d)
     v[b] = ROTR64 (v[b], 63);
 }
 
-void blabla_permuteadd (blabla_ctxt *ctxt)
+static void blabla_permute_rounds (uint64_t *w, int rounds)
 {
     int i;
-    uint64_t w[16];
 
-    memcpy (w, ctxt->v, 128);
-    for (i = 0; i < nROUNDS; ++i)
+    for (i = 0; i < rounds; ++i)
     {
         G (w, 0, 4, 8, 12);
         G (w, 1, 5, 9, 13);
@@ -68,35 +67,53 @@ void blabla_permuteadd (blabla_ctxt *ctxt)
         G (w, 2, 7, 8, 13);
         G (w, 3, 4, 9, 14);
     }
+}
+
+static void blabla_permuteadd_rounds (uint64_t *v, int rounds)
+{
+    int i;
+    uint64_t w[16];
+
+    memcpy (w, v, 128);
+    blabla_permute_rounds (w, rounds);
 
     for (i = 0; i < 16; ++i)
     {
-        ctxt->v[i] += w[i];
+        v[i] += w[i];
     }
 }
 
+void blabla_permuteadd (uint64_t *v)
+{
+    blabla_permuteadd_rounds (v, nROUNDS);
+}
+
 void blabla_ctxt_keystream_block (blabla_ctxt *ctxt, uint8_t *out)
 {
-    ctxt->v[0] = constants[0];
-    ctxt->v[1] = constants[1];
-    ctxt->v[2] = constants[2];
-    ctxt->v[3] = constants[3];
-    memcpy (&ctxt->v[4], ctxt->key, 32);
-    ctxt->v[8] = constants[4];
-    ctxt->v[9] = constants[5];
-    ctxt->v[10] = constants[6];
-    ctxt->v[11] = constants[7];
-    ctxt->v[12] = constants[8];
-    memcpy (&ctxt->v[13], ctxt->counter, 24);
+    uint64_t v[16];
+
+    v[0] = constants[0];
+    v[1] = constants[1];
+    v[2] = constants[2];
+    v[3] = constants[3];
+    memcpy (&v[4], ctxt->key, 32);
+    v[8] = constants[4];
+    v[9] = constants[5];
+    v[10] = constants[6];
+    v[11] = constants[7];
+    memcpy (&v[12], ctxt->counter, 32);
 
-    blabla_permuteadd (ctxt);
+    blabla_permuteadd (v);
 
-    memcpy (out, ctxt->v, 128);
-    ++ctxt->counter[0];
+    memcpy (out, v, 128);
+    ++ctxt->counter[1];
 }
 
 void blabla_ctxt_keystream (blabla_ctxt *ctxt, uint8_t *out, uint64_t len)
 {
+    uint64_t total = len;
+
+    STATS_ENTER (keystream, len, "ref");
     while (len >= BLOCK_LEN)
     {
         blabla_ctxt_keystream_block (ctxt, out);
@@ -104,6 +121,7 @@ void blabla_ctxt_keystream (blabla_ctxt *ctxt, uint8_t *out, uint64_t len)
         len -= BLOCK_LEN;
     }
 
+    STATS_TAIL (len);
     if (len > 0)
     {
         uint8_t block[BLOCK_LEN];
@@ -111,6 +129,7 @@ void blabla_ctxt_keystream (blabla_ctxt *ctxt, uint8_t *out, uint64_t len)
         blabla_ctxt_keystream_block (ctxt, block);
         memcpy (out, block, len);
     }
+    STATS_EXIT (keystream, total);
 }
 
 int blabla_keystream (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k)
@@ -134,32 +153,38 @@ int crypto_stream (unsigned char *out,
 void blabla_ctxt_xor_block (blabla_ctxt *ctxt, const uint8_t *in, uint8_t *out)
 {
     int i;
+    uint64_t v[16];
+
+    v[0] = constants[0];
+    v[1] = constants[1];
+    v[2] = constants[2];
+    v[3] = constants[3];
+    memcpy (&v[4], ctxt->key, 32);
+    v[8] = constants[4];
+    v[9] = constants[5];
+    v[10] = constants[6];
+    v[11] = constants[7];
+    memcpy (&v[12], ctxt->counter, 32);
+
+    blabla_permuteadd (v);
 
-    ctxt->v[0] = constants[0];
-    ctxt->v[1] = constants[1];
-    ctxt->v[2] = constants[2];
-    ctxt->v[3] = constants[3];
-    memcpy (&ctxt->v[4], ctxt->key, 32);
-    ctxt->v[8] = constants[4];
-    ctxt->v[9] = constants[5];
-    ctxt->v[10] = constants[6];
-    ctxt->v[11] = constants[7];
-    ctxt->v[12] = constants[8];
-    memcpy (&ctxt->v[13], ctxt->counter, 24);
-
-    blabla_permuteadd (ctxt);
-
-    const uint64_t *lin = (const uint64_t *)in;
-    uint64_t *lout = (uint64_t *)out;
+    /* in and out need not be aligned */
     for (i = 0; i < 16; ++i)
     {
-        lout[i] = ctxt->v[i] ^ lin[i];
+        uint64_t w;
+
+        memcpy (&w, in + 8 * i, 8);
+        w ^= v[i];
+        memcpy (out + 8 * i, &w, 8);
     }
-    ++ctxt->counter[0];
+    ++ctxt->counter[1];
 }
 
 void blabla_ctxt_xor (blabla_ctxt *ctxt, const uint8_t *in, uint8_t *out, uint64_t len)
 {
+    uint64_t total = len;
+
+    STATS_ENTER (xor, len, "ref");
     while (len >= BLOCK_LEN)
     {
         blabla_ctxt_xor_block (ctxt, in, out);
@@ -168,6 +193,7 @@ void blabla_ctxt_xor (blabla_ctxt *ctxt, const uint8_t *in, uint8_t *out, uint64
         len -= BLOCK_LEN;
     }
 
+    STATS_TAIL (len);
     if (len > 0)
     {
         uint8_t inblock[BLOCK_LEN];
@@ -177,6 +203,7 @@ void blabla_ctxt_xor (blabla_ctxt *ctxt, const uint8_t *in, uint8_t *out, uint64
         blabla_ctxt_xor_block (ctxt, inblock, outblock);
         memcpy (out, outblock, len);
     }
+    STATS_EXIT (xor, total);
 }
 
 int blabla_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k)
@@ -197,3 +224,214 @@ int crypto_stream_xor (unsigned char *out,
     return blabla_xor (out, in, inlen, n, k);
 }
 #endif
+
+void blabla_ctxt_double (blabla_ctxt *ctxt, double *out, uint64_t n)
+{
+    uint8_t *bytes = (uint8_t *)out;
+    uint64_t i;
+
+    blabla_ctxt_keystream (ctxt, bytes, 8 * n);
+    for (i = 0; i < n; ++i)
+    {
+        uint64_t w;
+        double d;
+
+        memcpy (&w, bytes + 8 * i, 8);
+        d = blabla_unit_double (w);
+        memcpy (bytes + 8 * i, &d, 8);
+    }
+}
+
+int blabla_xor_batch (const blabla_job *jobs, uint64_t count)
+{
+    uint64_t i;
+
+    for (i = 0; i < count; ++i)
+        blabla_xor (jobs[i].out, jobs[i].in, jobs[i].len, jobs[i].nonce, jobs[i].key);
+    return 0;
+}
+
+int blabla_xor_sectors (uint8_t *buf, uint64_t nsectors, uint64_t sector_size, uint64_t first_index, const uint8_t *k)
+{
+    blabla_ctxt ctxt;
+    uint64_t s;
+
+    blabla_ctxt_init_zero (&ctxt, k);
+    for (s = 0; s < nsectors; ++s)
+    {
+        ctxt.counter[1] = 1;
+        ctxt.counter[2] = first_index + s;
+        blabla_ctxt_xor (&ctxt, buf + s * sector_size, buf + s * sector_size, sector_size);
+    }
+    return 0;
+}
+
+static void blabla_block_rounds (blabla_ctxt *ctxt, uint8_t *block, int rounds)
+{
+    uint64_t v[16];
+
+    v[0] = constants[0];
+    v[1] = constants[1];
+    v[2] = constants[2];
+    v[3] = constants[3];
+    memcpy (&v[4], ctxt->key, 32);
+    v[8] = constants[4];
+    v[9] = constants[5];
+    v[10] = constants[6];
+    v[11] = constants[7];
+    memcpy (&v[12], ctxt->counter, 32);
+
+    blabla_permuteadd_rounds (v, rounds);
+
+    memcpy (block, v, 128);
+    ++ctxt->counter[1];
+}
+
+/* in == NULL for the keystream */
+static int blabla_rounds (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k, int rounds)
+{
+    blabla_ctxt ctxt;
+    uint8_t block[BLOCK_LEN];
+    uint64_t pos, i;
+
+    if (rounds != 6 && rounds != 8 && rounds != 10 && rounds != 12)
+        return -1;
+
+    blabla_ctxt_init (&ctxt, k, n);
+    for (pos = 0; pos < inlen; pos += BLOCK_LEN)
+    {
+        uint64_t len = inlen - pos < BLOCK_LEN ? inlen - pos : BLOCK_LEN;
+
+        blabla_block_rounds (&ctxt, block, rounds);
+        for (i = 0; i < len; ++i)
+            out[pos + i] = in != NULL ? in[pos + i] ^ block[i] : block[i];
+    }
+    return 0;
+}
+
+int blabla_keystream_rounds (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k, int rounds)
+{
+    return blabla_rounds (out, NULL, outlen, n, k, rounds);
+}
+
+int blabla_xor_rounds (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k, int rounds)
+{
+    return blabla_rounds (out, in, inlen, n, k, rounds);
+}
+
+static void blabla_aead_tag (uint8_t *tag, const uint8_t *c, uint64_t clen,
+                             const uint8_t *ad, uint64_t adlen, const uint8_t *n, const uint8_t *k)
+{
+    blabla_ctxt ctxt;
+    poly1305_state st;
+    uint8_t block[BLOCK_LEN];
+
+    /* Poly1305 key from block 0, the message uses blocks 1 and up */
+    blabla_ctxt_init (&ctxt, k, n);
+    ctxt.counter[1] = 0;
+    blabla_ctxt_keystream_block (&ctxt, block);
+    poly1305_init (&st, block);
+    blabla_wipe (block, sizeof (block));
+    blabla_wipe (&ctxt, sizeof (ctxt));
+
+    poly1305_padded (&st, ad, adlen);
+    poly1305_padded (&st, c, clen);
+    poly1305_lengths (&st, adlen, clen);
+    poly1305_finish (&st, tag);
+}
+
+int blabla_aead_encrypt (uint8_t *c, uint8_t *tag, const uint8_t *m, uint64_t mlen,
+                         const uint8_t *ad, uint64_t adlen, const uint8_t *n, const uint8_t *k)
+{
+    blabla_xor (c, m, mlen, n, k);
+    blabla_aead_tag (tag, c, mlen, ad, adlen, n, k);
+    return 0;
+}
+
+int blabla_aead_decrypt (uint8_t *m, const uint8_t *c, uint64_t clen, const uint8_t *tag,
+                         const uint8_t *ad, uint64_t adlen, const uint8_t *n, const uint8_t *k)
+{
+    uint8_t computed[16];
+
+    blabla_aead_tag (computed, c, clen, ad, adlen, n, k);
+    if (poly1305_verify (computed, tag) != 0)
+    {
+        blabla_wipe (computed, sizeof (computed));
+        memset (m, 0, clen);
+        return -1;
+    }
+    blabla_wipe (computed, sizeof (computed));
+    blabla_xor (m, c, clen, n, k);
+    return 0;
+}
+
+void hblabla_batch (uint8_t *out, const uint8_t *in, uint64_t count, const uint8_t *k)
+{
+    uint64_t v[16];
+    uint64_t s;
+
+    for (s = 0; s < count; ++s)
+    {
+        v[0] = constants[0];
+        v[1] = constants[1];
+        v[2] = constants[2];
+        v[3] = constants[3];
+        memcpy (&v[4], k, 32);
+        v[8] = constants[4];
+        v[9] = constants[5];
+        v[10] = constants[6];
+        v[11] = constants[7];
+        v[12] = ~constants[8];
+        v[13] = 0;
+        memcpy (&v[14], in + 16 * s, 16);
+
+        blabla_permute_rounds (v, nROUNDS);
+
+        memcpy (out + 32 * s, v, 32);
+    }
+}
+
+void blabla_permute (uint64_t *states, uint64_t count, int flags)
+{
+    uint64_t v[16], w[16];
+    uint64_t s;
+    int i;
+
+    for (s = 0; s < count; ++s)
+    {
+        for (i = 0; i < 16; ++i)
+            v[i] = (flags & BLABLA_PERMUTE_SOA) ? states[i * count + s] : states[16 * s + i];
+
+        memcpy (w, v, 128);
+        blabla_permute_rounds (w, nROUNDS);
+        if (flags & BLABLA_PERMUTE_FEEDFORWARD)
+        {
+            for (i = 0; i < 16; ++i)
+                w[i] += v[i];
+        }
+
+        for (i = 0; i < 16; ++i)
+        {
+            if (flags & BLABLA_PERMUTE_SOA)
+                states[i * count + s] = w[i];
+            else
+                states[16 * s + i] = w[i];
+        }
+    }
+}
+
+int blabla_keystream_with_key (uint8_t *out, uint64_t outlen, const uint8_t *n, const blabla_key *key)
+{
+    blabla_ctxt ctxt;
+    blabla_ctxt_init (&ctxt, (const uint8_t *)key->key, n);
+    blabla_ctxt_keystream (&ctxt, out, outlen);
+    return 0;
+}
+
+int blabla_xor_with_key (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const blabla_key *key)
+{
+    blabla_ctxt ctxt;
+    blabla_ctxt_init (&ctxt, (const uint8_t *)key->key, n);
+    blabla_ctxt_xor (&ctxt, in, out, inlen);
+    return 0;
+}
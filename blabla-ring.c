@@ -0,0 +1,183 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+/*
+ * Keystream precomputed ahead of a session. The stream is cut in slots of
+ * RING_SLOT bytes; slot s covers bytes [s * RING_SLOT, (s + 1) * RING_SLOT)
+ * and is kept in entry s % nslots of the ring, tagged with s once written.
+ *
+ * One producer (the background thread, or blabla_ring_fill) writes the
+ * slots ahead of the consumer, never further than nslots - 1 slots past the
+ * one the consumer is in, so that it never overwrites a slot that may still
+ * be read. The consumer (blabla_ring_xor) only XORs slots whose tag matches;
+ * for any other slot it computes the keystream itself with blabla_xor_at,
+ * and the producer later skips the slots it has passed.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "blabla.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* A whole number of cores for every backend, and a few packets */
+#define RING_SLOT (4 * BLABLA_STREAM_BUFLEN)
+/* Pause of the background thread once the ring is full */
+#define RING_POLL_NS 20000
+
+struct blabla_ring
+{
+    uint8_t *buf;
+    uint64_t *tags;
+    uint64_t nslots;
+    uint8_t key[32];
+    uint8_t nonce[16];
+
+    uint64_t pos __attribute__ ((aligned (64))); /* consumer, in bytes */
+    uint64_t produced __attribute__ ((aligned (64))); /* next slot to write */
+    int stop;
+    int background;
+    pthread_t thread;
+
+    blabla_ring_stats stats;
+};
+
+
+static void ring_write_slot (blabla_ring *ring, uint64_t s)
+{
+    blabla_ctxt ctxt;
+
+    blabla_ctxt_init (&ctxt, ring->key, ring->nonce);
+    ctxt.counter[1] += s * (RING_SLOT / BLOCK_LEN);
+    blabla_ctxt_keystream (&ctxt, ring->buf + (s % ring->nslots) * RING_SLOT, RING_SLOT);
+    __atomic_store_n (&ring->tags[s % ring->nslots], s, __ATOMIC_RELEASE);
+}
+
+/* Writes the slots that are not too far ahead, returns how many */
+static uint64_t ring_produce (blabla_ring *ring)
+{
+    uint64_t current = __atomic_load_n (&ring->pos, __ATOMIC_ACQUIRE) / RING_SLOT;
+    uint64_t s = ring->produced, n = 0;
+
+    if (s <= current)
+        s = current + 1;
+    for (; s < current + ring->nslots; ++s, ++n)
+        ring_write_slot (ring, s);
+    ring->produced = s;
+    return n;
+}
+
+static void *ring_thread (void *arg)
+{
+    blabla_ring *ring = arg;
+
+    while (!__atomic_load_n (&ring->stop, __ATOMIC_ACQUIRE))
+    {
+        if (ring_produce (ring) == 0)
+        {
+            struct timespec ts = { 0, RING_POLL_NS };
+
+            nanosleep (&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+blabla_ring *blabla_ring_create (const uint8_t *n, const uint8_t *k, uint64_t size, int background)
+{
+    blabla_ring *ring;
+    uint64_t i;
+
+    if (posix_memalign ((void **)&ring, 64, sizeof (*ring)) != 0)
+        return NULL;
+    memset (ring, 0, sizeof (*ring));
+    ring->nslots = (size + RING_SLOT - 1) / RING_SLOT;
+    if (ring->nslots < 2)
+        ring->nslots = 2;
+    memcpy (ring->key, k, 32);
+    memcpy (ring->nonce, n, 16);
+
+    ring->tags = malloc (ring->nslots * sizeof (uint64_t));
+    if (ring->tags == NULL || posix_memalign ((void **)&ring->buf, 64, ring->nslots * RING_SLOT) != 0)
+    {
+        free (ring->tags);
+        free (ring);
+        return NULL;
+    }
+    /* No consumer yet, so the whole ring can be written, slot 0 included */
+    for (i = 0; i < ring->nslots; ++i)
+        ring_write_slot (ring, i);
+    ring->produced = ring->nslots;
+    if (background)
+    {
+        if (pthread_create (&ring->thread, NULL, ring_thread, ring) != 0)
+        {
+            blabla_ring_destroy (ring);
+            return NULL;
+        }
+        ring->background = 1;
+    }
+    return ring;
+}
+
+void blabla_ring_fill (blabla_ring *ring)
+{
+    ring_produce (ring);
+}
+
+void blabla_ring_xor (blabla_ring *ring, const uint8_t *in, uint8_t *out, uint64_t len)
+{
+    uint64_t pos = ring->pos;
+
+    while (len > 0)
+    {
+        uint64_t s = pos / RING_SLOT;
+        uint64_t off = pos % RING_SLOT;
+        uint64_t n = RING_SLOT - off < len ? RING_SLOT - off : len;
+
+        if (__atomic_load_n (&ring->tags[s % ring->nslots], __ATOMIC_ACQUIRE) == s)
+        {
+            blabla_xor_bytes (out, in, ring->buf + (s % ring->nslots) * RING_SLOT + off, n);
+            ring->stats.ring_bytes += n;
+        }
+        else
+        {
+            /* Drained: compute this part of the keystream inline */
+            blabla_xor_at (out, in, n, pos, ring->nonce, ring->key);
+            ring->stats.inline_bytes += n;
+        }
+
+        pos += n;
+        in += n;
+        out += n;
+        len -= n;
+    }
+
+    /* Only now may the producer reuse the slots before pos */
+    __atomic_store_n (&ring->pos, pos, __ATOMIC_RELEASE);
+}
+
+void blabla_ring_get_stats (const blabla_ring *ring, blabla_ring_stats *stats)
+{
+    *stats = ring->stats;
+}
+
+void blabla_ring_destroy (blabla_ring *ring)
+{
+    if (ring->background)
+    {
+        __atomic_store_n (&ring->stop, 1, __ATOMIC_RELEASE);
+        pthread_join (ring->thread, NULL);
+    }
+
+    blabla_wipe (ring->buf, ring->nslots * RING_SLOT);
+    blabla_wipe (ring->key, sizeof (ring->key));
+    free (ring->buf);
+    free (ring->tags);
+    free (ring);
+}
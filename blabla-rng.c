@@ -0,0 +1,164 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+/*
+ * blabla_rng: random bytes served from a per-thread buffer of keystream.
+ * Every refill re-keys from its own first 32 bytes and served bytes are
+ * erased ("fast key erasure"), so the state never reveals past outputs. The
+ * state is seeded from getrandom and reseeded in the child after a fork.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "blabla.h"
+#include "util.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+
+/* Whole cores of every backend, and the state fits in two pages */
+#define RNG_BUFLEN (56 * BLOCK_LEN)
+
+typedef struct
+{
+    blabla_ctxt ctxt;
+    uint64_t pos;   /* next unused byte of buf */
+    uint64_t forks; /* value of rng_forks when seeded */
+    int seeded;
+    uint8_t buf[RNG_BUFLEN];
+} rng_state;
+
+static __thread rng_state *rng_tls;
+static pthread_key_t rng_key;
+static pthread_once_t rng_once = PTHREAD_ONCE_INIT;
+/* Forks seen by this process, for kernels without MADV_WIPEONFORK */
+static uint64_t rng_forks;
+
+
+/* Destructor of rng_key. A later destructor that draws again gets a new
+ * state from rng_get, which sets the key again for the next round. */
+static void rng_free (void *p)
+{
+    rng_tls = NULL;
+    blabla_wipe (p, sizeof (rng_state));
+    munmap (p, sizeof (rng_state));
+}
+
+static void rng_atfork_child (void)
+{
+    __atomic_add_fetch (&rng_forks, 1, __ATOMIC_RELAXED);
+}
+
+static void rng_init (void)
+{
+    pthread_key_create (&rng_key, rng_free);
+    pthread_atfork (NULL, NULL, rng_atfork_child);
+}
+
+static void rng_refill (rng_state *s)
+{
+    blabla_ctxt_keystream (&s->ctxt, s->buf, RNG_BUFLEN);
+    blabla_ctxt_init_zero (&s->ctxt, s->buf);
+    memset (s->buf, 0, 32);
+    s->pos = 32;
+}
+
+static int rng_seed (rng_state *s)
+{
+    uint8_t seed[32];
+    size_t got = 0;
+
+    while (got < sizeof (seed))
+    {
+        ssize_t r = getrandom (seed + got, sizeof (seed) - got, 0);
+
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        got += r;
+    }
+
+    blabla_ctxt_init_zero (&s->ctxt, seed);
+    blabla_wipe (seed, sizeof (seed));
+    rng_refill (s);
+    s->forks = __atomic_load_n (&rng_forks, __ATOMIC_RELAXED);
+    s->seeded = 1;
+    return 0;
+}
+
+static rng_state *rng_get (void)
+{
+    rng_state *s = rng_tls;
+
+    if (s == NULL)
+    {
+        pthread_once (&rng_once, rng_init);
+        s = mmap (NULL, sizeof (rng_state), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (s == MAP_FAILED)
+            return NULL;
+#ifdef MADV_WIPEONFORK
+        /* The child gets zero pages, hence an unseeded state */
+        madvise (s, sizeof (rng_state), MADV_WIPEONFORK);
+#endif
+        pthread_setspecific (rng_key, s);
+        rng_tls = s;
+    }
+
+    if (!s->seeded || s->forks != __atomic_load_n (&rng_forks, __ATOMIC_RELAXED))
+    {
+        if (rng_seed (s) != 0)
+            return NULL;
+    }
+    return s;
+}
+
+int blabla_rng_bytes (uint8_t *out, uint64_t len)
+{
+    rng_state *s = rng_get ();
+
+    if (s == NULL)
+        return -1;
+
+    while (len > 0)
+    {
+        uint64_t n;
+
+        if (s->pos == RNG_BUFLEN)
+        {
+            /* Large requests: whole blocks straight from the current key,
+             * which the refill then erases */
+            if (len >= RNG_BUFLEN)
+            {
+                n = len - len % BLOCK_LEN;
+                blabla_ctxt_keystream (&s->ctxt, out, n);
+                out += n;
+                len -= n;
+            }
+            rng_refill (s);
+        }
+
+        n = RNG_BUFLEN - s->pos < len ? RNG_BUFLEN - s->pos : len;
+        memcpy (out, s->buf + s->pos, n);
+        memset (s->buf + s->pos, 0, n);
+        s->pos += n;
+        out += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int blabla_rng_reseed (void)
+{
+    rng_state *s = rng_get ();
+
+    if (s == NULL)
+        return -1;
+    return rng_seed (s);
+}
@@ -0,0 +1,38 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+#include "blabla.h"
+
+
+int blabla6_keystream (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k)
+{
+    return blabla_keystream_rounds (out, outlen, n, k, 6);
+}
+
+int blabla6_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k)
+{
+    return blabla_xor_rounds (out, in, inlen, n, k, 6);
+}
+
+int blabla8_keystream (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k)
+{
+    return blabla_keystream_rounds (out, outlen, n, k, 8);
+}
+
+int blabla8_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k)
+{
+    return blabla_xor_rounds (out, in, inlen, n, k, 8);
+}
+
+int blabla12_keystream (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k)
+{
+    return blabla_keystream_rounds (out, outlen, n, k, 12);
+}
+
+int blabla12_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k)
+{
+    return blabla_xor_rounds (out, in, inlen, n, k, 12);
+}
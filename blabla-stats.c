@@ -0,0 +1,157 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+/*
+ * Counters behind the hooks of stats.h. Each thread only writes its own
+ * counters, with relaxed stores, so that blabla_stats_snapshot can read
+ * them at any time; they are added to stats_exited when the thread exits.
+ * Setting BLABLA_STATS=1 in the environment enables them at load time.
+ */
+
+#include "blabla.h"
+#include "stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct stats_thread
+{
+    uint64_t calls[2];
+    uint64_t bytes[2];
+    uint64_t tail_bytes;
+    const char *backend;
+    struct stats_thread *next;
+} stats_thread;
+
+int blabla_stats_on;
+
+static __thread stats_thread *stats_tls;
+static pthread_key_t stats_key;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_thread *stats_threads;
+static stats_thread stats_exited;
+
+#define STATS_ADD(x, v) __atomic_store_n (&(x), (x) + (v), __ATOMIC_RELAXED)
+#define STATS_LOAD(x) __atomic_load_n (&(x), __ATOMIC_RELAXED)
+
+
+static void stats_sum (blabla_stats *stats, const stats_thread *t)
+{
+    stats->keystream_calls += STATS_LOAD (t->calls[STATS_OP_keystream]);
+    stats->keystream_bytes += STATS_LOAD (t->bytes[STATS_OP_keystream]);
+    stats->xor_calls += STATS_LOAD (t->calls[STATS_OP_xor]);
+    stats->xor_bytes += STATS_LOAD (t->bytes[STATS_OP_xor]);
+    stats->tail_bytes += STATS_LOAD (t->tail_bytes);
+}
+
+/* Destructor of stats_key. A later destructor that counts again gets fresh
+ * counters from stats_get, which sets the key again, so that they are
+ * merged on the next round of destructors. */
+static void stats_free (void *p)
+{
+    stats_thread *t = p, **link;
+    int i;
+
+    stats_tls = NULL;
+    pthread_mutex_lock (&stats_lock);
+    for (link = &stats_threads; *link != t; link = &(*link)->next)
+        ;
+    *link = t->next;
+    for (i = 0; i < 2; ++i)
+    {
+        stats_exited.calls[i] += t->calls[i];
+        stats_exited.bytes[i] += t->bytes[i];
+    }
+    stats_exited.tail_bytes += t->tail_bytes;
+    pthread_mutex_unlock (&stats_lock);
+    free (t);
+}
+
+static void stats_init (void)
+{
+    pthread_key_create (&stats_key, stats_free);
+}
+
+static stats_thread *stats_get (void)
+{
+    stats_thread *t = stats_tls;
+
+    if (t == NULL)
+    {
+        pthread_once (&stats_once, stats_init);
+        t = calloc (1, sizeof (stats_thread));
+        if (t == NULL)
+            return NULL;
+        pthread_setspecific (stats_key, t);
+
+        pthread_mutex_lock (&stats_lock);
+        t->next = stats_threads;
+        stats_threads = t;
+        pthread_mutex_unlock (&stats_lock);
+        stats_tls = t;
+    }
+    return t;
+}
+
+__attribute__ ((constructor)) static void stats_env (void)
+{
+    const char *on = getenv ("BLABLA_STATS");
+
+    if (on != NULL && *on != '\0' && strcmp (on, "0"))
+        blabla_stats_enable (1);
+}
+
+void blabla_stats_count (int op, uint64_t len, const char *backend)
+{
+    stats_thread *t = stats_get ();
+
+    if (t == NULL)
+        return;
+    STATS_ADD (t->calls[op], 1);
+    STATS_ADD (t->bytes[op], len);
+    __atomic_store_n (&t->backend, backend, __ATOMIC_RELAXED);
+}
+
+void blabla_stats_tail (uint64_t len)
+{
+    stats_thread *t = stats_get ();
+
+    if (t != NULL)
+        STATS_ADD (t->tail_bytes, len);
+}
+
+void blabla_stats_enable (int on)
+{
+    __atomic_store_n (&blabla_stats_on, on != 0, __ATOMIC_RELAXED);
+}
+
+void blabla_stats_thread (blabla_stats *stats)
+{
+    const stats_thread *t = stats_tls;
+
+    memset (stats, 0, sizeof (*stats));
+    stats->backend = blabla_backend_name ();
+    if (t != NULL)
+    {
+        stats_sum (stats, t);
+        if (t->backend != NULL)
+            stats->backend = t->backend;
+    }
+}
+
+void blabla_stats_snapshot (blabla_stats *stats)
+{
+    const stats_thread *t;
+
+    memset (stats, 0, sizeof (*stats));
+    stats->backend = blabla_backend_name ();
+
+    pthread_mutex_lock (&stats_lock);
+    stats_sum (stats, &stats_exited);
+    for (t = stats_threads; t != NULL; t = t->next)
+        stats_sum (stats, t);
+    pthread_mutex_unlock (&stats_lock);
+}
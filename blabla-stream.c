@@ -0,0 +1,148 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+#include "blabla.h"
+#include "util.h"
+
+
+void blabla_stream_init (blabla_stream *stream, const uint8_t *n, const uint8_t *k)
+{
+    blabla_ctxt_init (&stream->ctxt, k, n);
+    stream->pos = BLABLA_STREAM_BUFLEN;
+}
+
+void blabla_stream_update (blabla_stream *stream, const uint8_t *in, uint8_t *out, uint64_t len)
+{
+    uint64_t n;
+
+    /* Keystream left over from the previous call */
+    n = BLABLA_STREAM_BUFLEN - stream->pos;
+    if (n > len)
+        n = len;
+    blabla_xor_bytes (out, in, stream->buf + stream->pos, n);
+    stream->pos += n;
+    in += n;
+    out += n;
+    len -= n;
+
+    /* Whole buffers go straight through the bulk path, which then never ends
+     * on a partial core */
+    n = len - len % BLABLA_STREAM_BUFLEN;
+    if (n >= BLABLA_STREAM_BUFLEN)
+    {
+        blabla_ctxt_xor (&stream->ctxt, in, out, n);
+        in += n;
+        out += n;
+        len -= n;
+    }
+
+    /* Refill with a full buffer, which is a whole number of cores for every
+     * backend, so that small updates also run at bulk speed */
+    if (len > 0)
+    {
+        blabla_ctxt_keystream (&stream->ctxt, stream->buf, BLABLA_STREAM_BUFLEN);
+        blabla_xor_bytes (out, in, stream->buf, len);
+        stream->pos = len;
+    }
+}
+
+/*
+ * The message is processed piece by piece, over the overlaps of the input and
+ * output fragments. Pieces go through blabla_stream_update, so that a core
+ * spanning fragments is still generated whole by the SIMD code; only the
+ * last piece ends with blabla_ctxt_xor and its tail kernel.
+ */
+int blabla_xorv (const struct iovec *in, int inc, const struct iovec *out, int outc,
+                 const uint8_t *n, const uint8_t *k)
+{
+    blabla_stream stream;
+    uint64_t total = 0, outtotal = 0, inoff = 0, outoff = 0;
+    int i, j;
+
+    for (i = 0; i < inc; ++i)
+        total += in[i].iov_len;
+    for (j = 0; j < outc; ++j)
+        outtotal += out[j].iov_len;
+    if (total != outtotal)
+        return -1;
+
+    blabla_stream_init (&stream, n, k);
+    i = 0;
+    j = 0;
+    while (total > 0)
+    {
+        const uint8_t *src;
+        uint8_t *dst;
+        uint64_t len;
+
+        /* Next non-empty fragments */
+        for (; inoff == in[i].iov_len; ++i)
+            inoff = 0;
+        for (; outoff == out[j].iov_len; ++j)
+            outoff = 0;
+
+        src = (const uint8_t *)in[i].iov_base + inoff;
+        dst = (uint8_t *)out[j].iov_base + outoff;
+        len = in[i].iov_len - inoff;
+        if (len > out[j].iov_len - outoff)
+            len = out[j].iov_len - outoff;
+
+        if (len == total)
+        {
+            /* Keystream left over, then the rest of the message at once */
+            uint64_t m = BLABLA_STREAM_BUFLEN - stream.pos;
+
+            if (m > len)
+                m = len;
+            blabla_xor_bytes (dst, src, stream.buf + stream.pos, m);
+            blabla_ctxt_xor (&stream.ctxt, src + m, dst + m, len - m);
+        }
+        else
+        {
+            blabla_stream_update (&stream, src, dst, len);
+        }
+
+        inoff += len;
+        outoff += len;
+        total -= len;
+    }
+
+    blabla_stream_final (&stream);
+    return 0;
+}
+
+int blabla_xor_at (uint8_t *out, const uint8_t *in, uint64_t inlen, uint64_t offset, const uint8_t *n, const uint8_t *k)
+{
+    blabla_ctxt ctxt;
+    uint64_t skip = offset % BLOCK_LEN;
+
+    blabla_ctxt_init (&ctxt, k, n);
+    ctxt.counter[1] += offset / BLOCK_LEN;
+
+    /* Partial first block */
+    if (skip != 0 && inlen > 0)
+    {
+        uint8_t block[BLOCK_LEN];
+        uint64_t len = BLOCK_LEN - skip;
+
+        if (len > inlen)
+            len = inlen;
+        blabla_ctxt_keystream (&ctxt, block, BLOCK_LEN);
+        blabla_xor_bytes (out, in, block + skip, len);
+        blabla_wipe (block, sizeof (block));
+        in += len;
+        out += len;
+        inlen -= len;
+    }
+
+    blabla_ctxt_xor (&ctxt, in, out, inlen);
+    return 0;
+}
+
+void blabla_stream_final (blabla_stream *stream)
+{
+    blabla_wipe (stream, sizeof (*stream));
+}
@@ -0,0 +1,66 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+#include "blabla.h"
+#include "util.h"
+
+
+void hblabla (uint8_t *out, const uint8_t *in, const uint8_t *k)
+{
+    hblabla_batch (out, in, 1, k);
+}
+
+void xblabla_ctxt_init (blabla_ctxt *ctxt, const uint8_t *key, const uint8_t *xnonce)
+{
+    uint8_t subkey[32];
+
+    hblabla (subkey, xnonce, key);
+    blabla_ctxt_init (ctxt, subkey, xnonce + 16);
+    blabla_wipe (subkey, sizeof (subkey));
+}
+
+int xblabla_keystream (uint8_t *out, uint64_t outlen, const uint8_t *xn, const uint8_t *k)
+{
+    uint8_t subkey[32];
+
+    hblabla (subkey, xn, k);
+    blabla_keystream (out, outlen, xn + 16, subkey);
+    blabla_wipe (subkey, sizeof (subkey));
+    return 0;
+}
+
+int xblabla_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *xn, const uint8_t *k)
+{
+    uint8_t subkey[32];
+
+    hblabla (subkey, xn, k);
+    blabla_xor (out, in, inlen, xn + 16, subkey);
+    blabla_wipe (subkey, sizeof (subkey));
+    return 0;
+}
+
+int xblabla_aead_encrypt (uint8_t *c, uint8_t *tag, const uint8_t *m, uint64_t mlen,
+                          const uint8_t *ad, uint64_t adlen, const uint8_t *xn, const uint8_t *k)
+{
+    uint8_t subkey[32];
+
+    hblabla (subkey, xn, k);
+    blabla_aead_encrypt (c, tag, m, mlen, ad, adlen, xn + 16, subkey);
+    blabla_wipe (subkey, sizeof (subkey));
+    return 0;
+}
+
+int xblabla_aead_decrypt (uint8_t *m, const uint8_t *c, uint64_t clen, const uint8_t *tag,
+                          const uint8_t *ad, uint64_t adlen, const uint8_t *xn, const uint8_t *k)
+{
+    uint8_t subkey[32];
+    int ret;
+
+    hblabla (subkey, xn, k);
+    ret = blabla_aead_decrypt (m, c, clen, tag, ad, adlen, xn + 16, subkey);
+    blabla_wipe (subkey, sizeof (subkey));
+    return ret;
+}
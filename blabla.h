@@ -4,9 +4,13 @@
  * Copyright (C) 2017 Nagravision S.A.
 */
 
+#ifndef BLABLA_H
+#define BLABLA_H
+
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #define BLOCK_LEN 128
 #define nROUNDS 10
@@ -27,5 +31,306 @@ static const uint64_t constants[9] = {
 };
 #endif
 
+/* Block counter, key and nonce of a message. counter[1] is the index of the
+ * next block and is advanced by every call (a partial block counts as a full
+ * one), so consecutive calls on whole blocks continue the same keystream. */
+typedef struct
+{
+    uint64_t key[4];
+    uint64_t counter[4];
+} blabla_ctxt;
+
+void blabla_ctxt_init (blabla_ctxt *ctxt, const uint8_t *key, const uint8_t *nonce);
+void blabla_ctxt_init_zero (blabla_ctxt *ctxt, const uint8_t *key);
+void blabla_ctxt_keystream (blabla_ctxt *ctxt, uint8_t *out, uint64_t len);
+void blabla_ctxt_xor (blabla_ctxt *ctxt, const uint8_t *in, uint8_t *out, uint64_t len);
+
+/* (x >> 12) * 2^-52: the 52 high bits of x as a double in [0, 1) */
+static inline double blabla_unit_double (uint64_t x)
+{
+    union
+    {
+        uint64_t u;
+        double d;
+    } v;
+
+    v.u = (x >> 12) | 0x3ff0000000000000ULL;
+    return v.d - 1.0;
+}
+
+/* Same as blabla_ctxt_keystream on 8 * n bytes, read as n little-endian
+ * 64-bit words and converted with blabla_unit_double. */
+void blabla_ctxt_double (blabla_ctxt *ctxt, double *out, uint64_t n);
+
+/* Streaming interface for messages processed in chunks of arbitrary sizes.
+ * Unused keystream is kept between calls, up to one core of the widest
+ * backend (8 blocks). */
+#define BLABLA_STREAM_BUFLEN (8 * BLOCK_LEN)
+
+typedef struct
+{
+    blabla_ctxt ctxt;
+    uint8_t buf[BLABLA_STREAM_BUFLEN];
+    uint64_t pos; /* next unused byte of buf */
+} blabla_stream;
+
+void blabla_stream_init (blabla_stream *stream, const uint8_t *n, const uint8_t *k);
+void blabla_stream_update (blabla_stream *stream, const uint8_t *in, uint8_t *out, uint64_t len);
+void blabla_stream_final (blabla_stream *stream);
+
+/* Same as blabla_xor on the concatenation of the inc input fragments, written
+ * to the outc output fragments, which may be cut at different places (or be
+ * the same, in place). Returns -1 if their total lengths differ. */
+int blabla_xorv (const struct iovec *in, int inc, const struct iovec *out, int outc,
+                 const uint8_t *n, const uint8_t *k);
+
+/* A key prepared for many messages: the key and the constant words of the
+ * initial state, each repeated in all lanes of the widest backend (8), so
+ * that the SIMD code loads them instead of broadcasting them for every
+ * message. It is only read after blabla_key_init and can be shared between
+ * threads. The _with_key functions give the same output as blabla_keystream
+ * and blabla_xor under the raw key. */
+#define BLABLA_KEY_LANES 8
+
+typedef struct
+{
+    uint64_t lanes[13][BLABLA_KEY_LANES] __attribute__ ((aligned (64))); /* x0..x12 */
+    uint64_t key[4];
+} blabla_key;
+
+void blabla_key_init (blabla_key *key, const uint8_t *k);
+void blabla_key_wipe (blabla_key *key);
+int blabla_keystream_with_key (uint8_t *out, uint64_t outlen, const uint8_t *n, const blabla_key *key);
+int blabla_xor_with_key (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const blabla_key *key);
+
+/* Same as the bytes [offset, offset + inlen) of blabla_xor on a longer
+ * message, without computing the keystream before offset. */
+int blabla_xor_at (uint8_t *out, const uint8_t *in, uint64_t inlen, uint64_t offset, const uint8_t *n, const uint8_t *k);
+
 int blabla_keystream (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k);
 int blabla_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k);
+
+/* Variants with 6, 8 or 12 double rounds instead of nROUNDS (10): faster for
+ * non-adversarial uses, or more conservative. The _rounds functions take the
+ * count as a parameter and return -1 for any other value. */
+int blabla_keystream_rounds (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k, int rounds);
+int blabla_xor_rounds (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k, int rounds);
+int blabla6_keystream (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k);
+int blabla6_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k);
+int blabla8_keystream (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k);
+int blabla8_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k);
+int blabla12_keystream (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k);
+int blabla12_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k);
+
+/* Applies the permutation of nROUNDS double rounds in place to count states
+ * of 16 words. States are consecutive (AoS: word w of state i is
+ * states[16 * i + w]) unless flags has BLABLA_PERMUTE_SOA (word w of state i
+ * is states[w * count + i]), which the SIMD code loads without transposing.
+ * BLABLA_PERMUTE_FEEDFORWARD adds the input to the output, as for a block of
+ * keystream. */
+#define BLABLA_PERMUTE_SOA         1
+#define BLABLA_PERMUTE_FEEDFORWARD 2
+
+void blabla_permute (uint64_t *states, uint64_t count, int flags);
+
+/* HBlaBla: a 32-byte subkey from a key and a 16-byte input, for extended
+ * nonces as HChaCha does for XChaCha. The input goes in place of the nonce,
+ * x12 is ~constants[8] and x13 is 0, so that the state is never that of a
+ * block of the stream cipher; the subkey is the first row x0..x3 after the
+ * rounds, without the final addition. hblabla_batch derives count subkeys
+ * under the same key, one input per SIMD lane: in is count * 16 bytes and
+ * out count * 32 bytes. */
+void hblabla (uint8_t *out, const uint8_t *in, const uint8_t *k);
+void hblabla_batch (uint8_t *out, const uint8_t *in, uint64_t count, const uint8_t *k);
+
+/* XBlaBla: BlaBla with a 32-byte nonce, long enough to be picked at random.
+ * The key of the message is hblabla (xn, k), its nonce the last 16 bytes of
+ * xn. The AEAD is blabla_aead_* under that key and nonce. */
+#define XBLABLA_NONCE_LEN 32
+
+void xblabla_ctxt_init (blabla_ctxt *ctxt, const uint8_t *key, const uint8_t *xnonce);
+int xblabla_keystream (uint8_t *out, uint64_t outlen, const uint8_t *xn, const uint8_t *k);
+int xblabla_xor (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *xn, const uint8_t *k);
+int xblabla_aead_encrypt (uint8_t *c, uint8_t *tag, const uint8_t *m, uint64_t mlen,
+                          const uint8_t *ad, uint64_t adlen, const uint8_t *xn, const uint8_t *k);
+int xblabla_aead_decrypt (uint8_t *m, const uint8_t *c, uint64_t clen, const uint8_t *tag,
+                          const uint8_t *ad, uint64_t adlen, const uint8_t *xn, const uint8_t *k);
+
+/* One message of a batch, keys and nonces as for blabla_xor */
+typedef struct
+{
+    const uint8_t *key;
+    const uint8_t *nonce;
+    const uint8_t *in;
+    uint8_t *out;
+    uint64_t len;
+} blabla_job;
+
+/* Same as blabla_xor on each job, with independent messages processed in
+ * parallel in the SIMD lanes. */
+int blabla_xor_batch (const blabla_job *jobs, uint64_t count);
+
+/* Encrypts nsectors consecutive sectors of sector_size bytes in place. The
+ * nonce of sector i is first_index + i as a little-endian 64-bit integer,
+ * followed by 8 zero bytes. */
+int blabla_xor_sectors (uint8_t *buf, uint64_t nsectors, uint64_t sector_size, uint64_t first_index, const uint8_t *k);
+
+/* Same output as blabla_xor, computed by up to nthreads threads (0: one per
+ * online CPU) of a persistent worker pool. Inputs under 1 MiB are processed
+ * by the calling thread only. */
+int blabla_xor_mt (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k, int nthreads);
+
+/* Asynchronous engine: blabla_engine_submit queues a request and returns at
+ * once, and a pool of worker threads encrypts it as by blabla_xor. Small
+ * requests queued together are encrypted together in the SIMD lanes, large
+ * ones are split between workers. The request must stay valid until it is
+ * complete: then done is called on a worker thread if it is set; otherwise
+ * blabla_request_done returns 1, and 8 bytes (1 as a uint64_t) are written
+ * to fd unless it is -1, which suits an eventfd or a pipe. */
+typedef struct blabla_request
+{
+    blabla_job job;
+    void (*done) (struct blabla_request *req);
+    void *arg; /* for the caller */
+    int fd;
+
+    /* Engine state */
+    int status;
+    int refs;
+    uint64_t submitted;
+    uint64_t next;
+    uint64_t nchunks;
+} blabla_request;
+
+/* Latency from submission to completion, in buckets [2^i, 2^(i+1)) ns */
+#define BLABLA_ENGINE_BUCKETS 40
+
+typedef struct
+{
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t rejected;      /* queue full */
+    uint64_t batches;       /* calls to blabla_xor_batch or blabla_xor */
+    uint64_t depth;         /* entries in the queue */
+    uint64_t notify_errors; /* failed writes to fd */
+    uint64_t latency_sum;   /* ns */
+    uint64_t latency[BLABLA_ENGINE_BUCKETS];
+} blabla_engine_stats;
+
+typedef struct blabla_engine blabla_engine;
+
+/* nworkers threads (0: one per online CPU), and a queue of at least depth
+ * entries. blabla_engine_destroy finishes the queued requests first. */
+blabla_engine *blabla_engine_create (int nworkers, uint64_t depth);
+void blabla_engine_destroy (blabla_engine *e);
+/* 0, or -1 if the queue is full */
+int blabla_engine_submit (blabla_engine *e, blabla_request *req);
+int blabla_request_done (const blabla_request *req);
+void blabla_engine_get_stats (blabla_engine *e, blabla_engine_stats *stats);
+
+/* Keystream of one session computed ahead, so that encrypting a packet is
+ * only a XOR. Successive calls to blabla_ring_xor continue the keystream,
+ * as blabla_stream_update does. The ring holds at least size bytes ahead;
+ * it is refilled by a background thread if background is set, or else by
+ * blabla_ring_fill, e.g. when the caller is idle (one or the other, from a
+ * single thread). When the ring is drained, the keystream is computed
+ * inline. blabla_ring_xor must be called from a single thread at a time. */
+typedef struct
+{
+    uint64_t ring_bytes;   /* XORed with precomputed keystream */
+    uint64_t inline_bytes; /* ring drained */
+} blabla_ring_stats;
+
+typedef struct blabla_ring blabla_ring;
+
+blabla_ring *blabla_ring_create (const uint8_t *n, const uint8_t *k, uint64_t size, int background);
+void blabla_ring_destroy (blabla_ring *ring);
+void blabla_ring_fill (blabla_ring *ring);
+void blabla_ring_xor (blabla_ring *ring, const uint8_t *in, uint8_t *out, uint64_t len);
+void blabla_ring_get_stats (const blabla_ring *ring, blabla_ring_stats *stats);
+
+/* BlaBla-Poly1305 authenticated encryption, built like ChaCha20-Poly1305
+ * (RFC 8439): the Poly1305 key is the first 32 bytes of block 0 of the
+ * keystream, the message is encrypted from block 1 exactly as by blabla_xor,
+ * and the 16-byte tag covers ad and the ciphertext. blabla_aead_decrypt
+ * returns -1 and zeroes m if the tag is wrong; it decrypts and verifies in
+ * a single pass, so m must not be used before it returns. c and m may be
+ * the same buffer. */
+int blabla_aead_encrypt (uint8_t *c, uint8_t *tag, const uint8_t *m, uint64_t mlen,
+                         const uint8_t *ad, uint64_t adlen, const uint8_t *n, const uint8_t *k);
+int blabla_aead_decrypt (uint8_t *m, const uint8_t *c, uint64_t clen, const uint8_t *tag,
+                         const uint8_t *ad, uint64_t adlen, const uint8_t *n, const uint8_t *k);
+/* Poly1305 one-time authenticator (RFC 8439), the key is for one message */
+void blabla_poly1305 (uint8_t *tag, const uint8_t *m, uint64_t len, const uint8_t *key);
+
+/* Deterministic generator: the keystream under a 32-byte seed and the
+ * nonce (stream, 0), read as little-endian 64-bit words. Every draw consumes
+ * whole words, so the output only depends on the seed, the stream and the
+ * number of words drawn so far, not on how draws are split into calls.
+ * blabla_prng_jump skips words in constant time; different streams, or
+ * jumps of 2^k words, give disjoint substreams to parallel workers. */
+typedef struct
+{
+    blabla_ctxt ctxt;
+    uint64_t buf[BLABLA_STREAM_BUFLEN / 8];
+    uint64_t pos; /* next unused word of buf */
+    uint64_t len; /* words in buf */
+} blabla_prng;
+
+void blabla_prng_init (blabla_prng *rng, const uint8_t *seed, uint64_t stream);
+void blabla_prng_jump (blabla_prng *rng, uint64_t nwords);
+uint64_t blabla_prng_u64 (blabla_prng *rng);
+/* Multiples of 2^-52 in [0, 1), see blabla_unit_double */
+double blabla_prng_double (blabla_prng *rng);
+/* Uniform in [0, range), range > 0, by Lemire's multiply-and-reject: one
+ * word per value except with probability below range / 2^64. */
+uint64_t blabla_prng_bounded (blabla_prng *rng, uint64_t range);
+/* One word per value, written directly by the SIMD code except for the
+ * words buffered by previous single draws. blabla_prng_fill_bounded draws
+ * all candidates first, so after a rejection its output differs from n
+ * calls to blabla_prng_bounded. */
+void blabla_prng_fill_u64 (blabla_prng *rng, uint64_t *out, uint64_t n);
+void blabla_prng_fill_double (blabla_prng *rng, double *out, uint64_t n);
+void blabla_prng_fill_bounded (blabla_prng *rng, uint64_t *out, uint64_t n, uint64_t range);
+
+/* Cryptographically secure random bytes from a per-thread buffer of
+ * keystream, re-keyed after every refill so that past outputs cannot be
+ * recovered from the state. Seeded from getrandom on first use and reseeded
+ * after fork(); blabla_rng_reseed forces a reseed (e.g. after restoring a VM
+ * snapshot). Return -1 if the seed cannot be obtained. */
+int blabla_rng_bytes (uint8_t *out, uint64_t len);
+int blabla_rng_reseed (void);
+
+/* Name of the implementation in use ("ref", "sse2", "ssse3", "avx2", ...).
+ * In libblabla this is the backend selected at load time, which can be
+ * forced with the BLABLA_BACKEND environment variable. */
+const char *blabla_backend_name (void);
+
+/* Counters of the keystream and XOR code, kept per thread and off by
+ * default: until blabla_stats_enable (1), or BLABLA_STATS=1 in the
+ * environment, they cost one branch per call. Calls and bytes count the
+ * calls of the loops behind blabla_ctxt_keystream and blabla_ctxt_xor,
+ * including those made by the layers above them (blabla_xor, streams,
+ * _with_key, _rounds...), but not the batch and sector loops. The AEAD
+ * shows up through its Poly1305 key block and the tail of the message,
+ * which go through those calls, but not through its bulk SIMD loop, which
+ * encrypts and absorbs whole cores together (ref counts all of it).
+ * tail_bytes are the bytes after the last whole core (block, for ref),
+ * which take the partial path. backend is the implementation that ran the
+ * calls. blabla_stats_thread covers the calling thread,
+ * blabla_stats_snapshot all threads, including those that exited. */
+typedef struct
+{
+    uint64_t keystream_calls;
+    uint64_t keystream_bytes;
+    uint64_t xor_calls;
+    uint64_t xor_bytes;
+    uint64_t tail_bytes;
+    const char *backend;
+} blabla_stats;
+
+void blabla_stats_enable (int on);
+void blabla_stats_thread (blabla_stats *stats);
+void blabla_stats_snapshot (blabla_stats *stats);
+
+#endif
@@ -7,6 +7,10 @@
 #ifndef BLABLA_CONFIG_H
 #define BLABLA_CONFIG_H
 
+/* -DBLABLA_GENERIC selects the portable backend on vector extensions even on
+ * x86; it is also the fallback when no SSE2 is detected. */
+#ifndef BLABLA_GENERIC
+
 /* These don't work everywhere */
 #if defined(__SSE2__) || defined(__x86_64__) || defined(__amd64__)
 #pragma message "Detected SSE2."
@@ -23,6 +27,29 @@
 #define HAVE_AVX2
 #endif
 
+/* AVX-512VL gives native 64-bit rotations on 256-bit vectors. Unless NO_ZMM
+ * is defined, AVX-512F additionally switches to 512-bit vectors (8 blocks
+ * per core); NO_ZMM is for hosts that downclock on zmm registers. */
+#if defined(__AVX512F__) && defined(__AVX512VL__)
+#pragma message "Detected AVX-512."
+#define HAVE_AVX512VL
+#ifndef NO_ZMM
+#define HAVE_AVX512F
+#endif
+#endif
+
+/* Byte-masked loads and stores for the end of a message */
+#if defined(HAVE_AVX512VL) && defined(__AVX512BW__)
+#define HAVE_AVX512BW
+#endif
+
+
+#ifdef HAVE_AVX512VL
+#ifndef HAVE_AVX2
+#define HAVE_AVX2
+#endif
+#endif
+
 
 #ifdef HAVE_AVX2
 #ifndef HAVE_SSSE3
@@ -35,7 +62,57 @@
 #endif
 
 #if !defined(HAVE_SSE2)
-#error "This code requires at least SSE2."
+#pragma message "No SSE2, using generic vectors."
+#define BLABLA_GENERIC
+#endif
+
+#endif /* BLABLA_GENERIC */
+
+#if defined(BLABLA_GENERIC)
+#define BLABLA_ISA "generic"
+#elif defined(HAVE_AVX512F)
+#define BLABLA_ISA "avx512"
+#elif defined(HAVE_AVX512VL)
+#define BLABLA_ISA "avx512vl"
+#elif defined(HAVE_AVX2)
+#define BLABLA_ISA "avx2"
+#elif defined(HAVE_SSSE3)
+#define BLABLA_ISA "ssse3"
+#else
+#define BLABLA_ISA "sse2"
+#endif
+
+
+/*
+ * When building libblabla, blabla-opt.c is compiled once per ISA with
+ * -DBLABLA_IMPL=<isa>. Every exported symbol then gets an _<isa> suffix so
+ * that the objects can be linked together, and blabla-dispatch.c picks one
+ * of them at load time.
+ */
+#define BLABLA_CONCAT_(a, b) a##_##b
+#define BLABLA_CONCAT(a, b)  BLABLA_CONCAT_ (a, b)
+
+#ifdef BLABLA_IMPL
+#define BLABLA_NAME(f) BLABLA_CONCAT (f, BLABLA_IMPL)
+
+#define blabla_ctxt_init      BLABLA_NAME (blabla_ctxt_init)
+#define blabla_ctxt_init_zero BLABLA_NAME (blabla_ctxt_init_zero)
+#define blabla_ctxt_keystream BLABLA_NAME (blabla_ctxt_keystream)
+#define blabla_ctxt_xor       BLABLA_NAME (blabla_ctxt_xor)
+#define blabla_keystream      BLABLA_NAME (blabla_keystream)
+#define blabla_xor            BLABLA_NAME (blabla_xor)
+#define blabla_xor_batch      BLABLA_NAME (blabla_xor_batch)
+#define blabla_xor_sectors    BLABLA_NAME (blabla_xor_sectors)
+#define blabla_keystream_rounds BLABLA_NAME (blabla_keystream_rounds)
+#define blabla_xor_rounds     BLABLA_NAME (blabla_xor_rounds)
+#define blabla_ctxt_double    BLABLA_NAME (blabla_ctxt_double)
+#define blabla_aead_encrypt   BLABLA_NAME (blabla_aead_encrypt)
+#define blabla_aead_decrypt   BLABLA_NAME (blabla_aead_decrypt)
+#define hblabla_batch         BLABLA_NAME (hblabla_batch)
+#define blabla_permute        BLABLA_NAME (blabla_permute)
+#define blabla_keystream_with_key BLABLA_NAME (blabla_keystream_with_key)
+#define blabla_xor_with_key   BLABLA_NAME (blabla_xor_with_key)
+#define blabla_backend_name   BLABLA_NAME (blabla_backend_name)
 #endif
 
 #endif
@@ -0,0 +1,44 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+#ifndef BLABLA_DISPATCH_H
+#define BLABLA_DISPATCH_H
+
+#include "blabla.h"
+
+/* Entry points of one backend, see blabla-dispatch.c */
+typedef struct
+{
+    const char *name;
+    void (*ctxt_init) (blabla_ctxt *ctxt, const uint8_t *key, const uint8_t *nonce);
+    void (*ctxt_init_zero) (blabla_ctxt *ctxt, const uint8_t *key);
+    void (*ctxt_keystream) (blabla_ctxt *ctxt, uint8_t *out, uint64_t len);
+    void (*ctxt_xor) (blabla_ctxt *ctxt, const uint8_t *in, uint8_t *out, uint64_t len);
+    int (*keystream) (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k);
+    int (*xor) (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k);
+    int (*xor_batch) (const blabla_job *jobs, uint64_t count);
+    int (*xor_sectors) (uint8_t *buf, uint64_t nsectors, uint64_t sector_size, uint64_t first_index, const uint8_t *k);
+    int (*keystream_rounds) (uint8_t *out, uint64_t outlen, const uint8_t *n, const uint8_t *k, int rounds);
+    int (*xor_rounds) (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const uint8_t *k, int rounds);
+    void (*ctxt_double) (blabla_ctxt *ctxt, double *out, uint64_t n);
+    int (*aead_encrypt) (uint8_t *c, uint8_t *tag, const uint8_t *m, uint64_t mlen,
+                         const uint8_t *ad, uint64_t adlen, const uint8_t *n, const uint8_t *k);
+    int (*aead_decrypt) (uint8_t *m, const uint8_t *c, uint64_t clen, const uint8_t *tag,
+                         const uint8_t *ad, uint64_t adlen, const uint8_t *n, const uint8_t *k);
+    void (*hblabla_batch) (uint8_t *out, const uint8_t *in, uint64_t count, const uint8_t *k);
+    void (*permute) (uint64_t *states, uint64_t count, int flags);
+    int (*keystream_with_key) (uint8_t *out, uint64_t outlen, const uint8_t *n, const blabla_key *key);
+    int (*xor_with_key) (uint8_t *out, const uint8_t *in, uint64_t inlen, const uint8_t *n, const blabla_key *key);
+} blabla_backend;
+
+extern const blabla_backend blabla_backend_sse2;
+extern const blabla_backend blabla_backend_ssse3;
+extern const blabla_backend blabla_backend_avx2;
+extern const blabla_backend blabla_backend_avx512vl;
+extern const blabla_backend blabla_backend_avx512;
+extern const blabla_backend blabla_backend_generic;
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+/*
+ * Scalar Poly1305 after poly1305-donna (Andrew Moon), radix 2^26 so that the
+ * limbs can be moved to and from the SIMD lanes of blabla-opt.c as they are.
+ */
+
+#ifndef POLY1305_H
+#define POLY1305_H
+
+#include "util.h"
+#include <stdint.h>
+#include <string.h>
+
+#define POLY1305_MASK 0x3ffffff
+
+typedef struct
+{
+    uint32_t r[5];
+    uint32_t h[5];
+    uint32_t pad[4];
+} poly1305_state;
+
+
+static inline uint32_t poly1305_load32 (const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void poly1305_store32 (uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline void poly1305_init (poly1305_state *st, const uint8_t *key)
+{
+    /* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+    st->r[0] = (poly1305_load32 (key + 0)) & 0x3ffffff;
+    st->r[1] = (poly1305_load32 (key + 3) >> 2) & 0x3ffff03;
+    st->r[2] = (poly1305_load32 (key + 6) >> 4) & 0x3ffc0ff;
+    st->r[3] = (poly1305_load32 (key + 9) >> 6) & 0x3f03fff;
+    st->r[4] = (poly1305_load32 (key + 12) >> 8) & 0x00fffff;
+
+    memset (st->h, 0, sizeof (st->h));
+
+    st->pad[0] = poly1305_load32 (key + 16);
+    st->pad[1] = poly1305_load32 (key + 20);
+    st->pad[2] = poly1305_load32 (key + 24);
+    st->pad[3] = poly1305_load32 (key + 28);
+}
+
+/* h = h * r mod 2^130 - 5, partially reduced: limbs stay below 2^26 + 2^6 */
+static inline void poly1305_mulmod (uint32_t *h, const uint32_t *r)
+{
+    uint64_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+    uint64_t d0, d1, d2, d3, d4, c;
+
+    d0 = (uint64_t)h[0] * r[0] + h[1] * s4 + h[2] * s3 + h[3] * s2 + h[4] * s1;
+    d1 = (uint64_t)h[0] * r[1] + (uint64_t)h[1] * r[0] + h[2] * s4 + h[3] * s3 + h[4] * s2;
+    d2 = (uint64_t)h[0] * r[2] + (uint64_t)h[1] * r[1] + (uint64_t)h[2] * r[0] + h[3] * s4 + h[4] * s3;
+    d3 = (uint64_t)h[0] * r[3] + (uint64_t)h[1] * r[2] + (uint64_t)h[2] * r[1] + (uint64_t)h[3] * r[0] + h[4] * s4;
+    d4 = (uint64_t)h[0] * r[4] + (uint64_t)h[1] * r[3] + (uint64_t)h[2] * r[2] + (uint64_t)h[3] * r[1] + (uint64_t)h[4] * r[0];
+
+    c = d0 >> 26;
+    h[0] = d0 & POLY1305_MASK;
+    d1 += c;
+    c = d1 >> 26;
+    h[1] = d1 & POLY1305_MASK;
+    d2 += c;
+    c = d2 >> 26;
+    h[2] = d2 & POLY1305_MASK;
+    d3 += c;
+    c = d3 >> 26;
+    h[3] = d3 & POLY1305_MASK;
+    d4 += c;
+    c = d4 >> 26;
+    h[4] = d4 & POLY1305_MASK;
+    h[0] += c * 5;
+    c = h[0] >> 26;
+    h[0] &= POLY1305_MASK;
+    h[1] += c;
+}
+
+/* Whole 16-byte blocks, hibit is 1 << 24 for all but a padded final block */
+static inline void poly1305_blocks (poly1305_state *st, const uint8_t *m, uint64_t nblocks, uint32_t hibit)
+{
+    while (nblocks-- > 0)
+    {
+        st->h[0] += (poly1305_load32 (m + 0)) & POLY1305_MASK;
+        st->h[1] += (poly1305_load32 (m + 3) >> 2) & POLY1305_MASK;
+        st->h[2] += (poly1305_load32 (m + 6) >> 4) & POLY1305_MASK;
+        st->h[3] += (poly1305_load32 (m + 9) >> 6) & POLY1305_MASK;
+        st->h[4] += (poly1305_load32 (m + 12) >> 8) | hibit;
+        poly1305_mulmod (st->h, st->r);
+        m += 16;
+    }
+}
+
+/* Data padded with zeros to a multiple of 16 bytes, as in the AEAD */
+static inline void poly1305_padded (poly1305_state *st, const uint8_t *m, uint64_t len)
+{
+    poly1305_blocks (st, m, len / 16, 1 << 24);
+    if (len % 16 != 0)
+    {
+        uint8_t block[16] = { 0 };
+
+        memcpy (block, m + len - len % 16, len % 16);
+        poly1305_blocks (st, block, 1, 1 << 24);
+    }
+}
+
+static inline void poly1305_finish (poly1305_state *st, uint8_t *tag)
+{
+    uint32_t h0, h1, h2, h3, h4, c;
+    uint32_t g0, g1, g2, g3, g4, mask;
+    uint64_t f;
+
+    /* fully carry h */
+    h0 = st->h[0];
+    h1 = st->h[1];
+    h2 = st->h[2];
+    h3 = st->h[3];
+    h4 = st->h[4];
+
+    c = h1 >> 26;
+    h1 &= POLY1305_MASK;
+    h2 += c;
+    c = h2 >> 26;
+    h2 &= POLY1305_MASK;
+    h3 += c;
+    c = h3 >> 26;
+    h3 &= POLY1305_MASK;
+    h4 += c;
+    c = h4 >> 26;
+    h4 &= POLY1305_MASK;
+    h0 += c * 5;
+    c = h0 >> 26;
+    h0 &= POLY1305_MASK;
+    h1 += c;
+
+    /* compute h - p and select it if h >= p, in constant time */
+    g0 = h0 + 5;
+    c = g0 >> 26;
+    g0 &= POLY1305_MASK;
+    g1 = h1 + c;
+    c = g1 >> 26;
+    g1 &= POLY1305_MASK;
+    g2 = h2 + c;
+    c = g2 >> 26;
+    g2 &= POLY1305_MASK;
+    g3 = h3 + c;
+    c = g3 >> 26;
+    g3 &= POLY1305_MASK;
+    g4 = h4 + c - (1UL << 26);
+
+    mask = (g4 >> 31) - 1;
+    g0 &= mask;
+    g1 &= mask;
+    g2 &= mask;
+    g3 &= mask;
+    g4 &= mask;
+    mask = ~mask;
+    h0 = (h0 & mask) | g0;
+    h1 = (h1 & mask) | g1;
+    h2 = (h2 & mask) | g2;
+    h3 = (h3 & mask) | g3;
+    h4 = (h4 & mask) | g4;
+
+    /* h = h % 2^128, then h + pad */
+    h0 = ((h0) | (h1 << 26)) & 0xffffffff;
+    h1 = ((h1 >> 6) | (h2 << 20)) & 0xffffffff;
+    h2 = ((h2 >> 12) | (h3 << 14)) & 0xffffffff;
+    h3 = ((h3 >> 18) | (h4 << 8)) & 0xffffffff;
+
+    f = (uint64_t)h0 + st->pad[0];
+    poly1305_store32 (tag + 0, f);
+    f = (uint64_t)h1 + st->pad[1] + (f >> 32);
+    poly1305_store32 (tag + 4, f);
+    f = (uint64_t)h2 + st->pad[2] + (f >> 32);
+    poly1305_store32 (tag + 8, f);
+    f = (uint64_t)h3 + st->pad[3] + (f >> 32);
+    poly1305_store32 (tag + 12, f);
+
+    blabla_wipe (st, sizeof (*st));
+}
+
+/* Lengths block of the AEAD */
+static inline void poly1305_lengths (poly1305_state *st, uint64_t adlen, uint64_t len)
+{
+    uint8_t block[16];
+    int i;
+
+    for (i = 0; i < 8; ++i)
+    {
+        block[i] = adlen >> (8 * i);
+        block[8 + i] = len >> (8 * i);
+    }
+    poly1305_blocks (st, block, 1, 1 << 24);
+}
+
+/* 0 if the tags are equal, -1 otherwise, in constant time */
+static inline int poly1305_verify (const uint8_t *a, const uint8_t *b)
+{
+    uint32_t d = 0;
+    int i;
+
+    for (i = 0; i < 16; ++i)
+        d |= a[i] ^ b[i];
+    return (int)((1 & ((d - 1) >> 8)) - 1);
+}
+
+#endif
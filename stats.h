@@ -0,0 +1,71 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+/*
+ * Hooks of the keystream and XOR code. Counters are kept per thread by
+ * blabla-stats.c once enabled at run time; disabled, a call costs a load
+ * and a branch predicted not taken. Where <sys/sdt.h> is available, the
+ * calls are also marked with USDT probes (provider blabla, probes
+ * keystream_entry, keystream_exit, xor_entry and xor_exit, argument: the
+ * length), which are nops until a tracer attaches. -DBLABLA_NO_STATS
+ * removes both.
+ */
+
+#ifndef BLABLA_STATS_H
+#define BLABLA_STATS_H
+
+#include <stdint.h>
+
+#define STATS_OP_keystream 0
+#define STATS_OP_xor 1
+
+extern int blabla_stats_on;
+
+void blabla_stats_count (int op, uint64_t len, const char *backend);
+void blabla_stats_tail (uint64_t len);
+
+#if !defined(BLABLA_NO_STATS) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define STATS_PROBE(name, len) DTRACE_PROBE1 (blabla, name, len)
+#endif
+#endif
+
+#ifndef STATS_PROBE
+#define STATS_PROBE(name, len) do { (void)(len); } while (0)
+#endif
+
+#ifdef BLABLA_NO_STATS
+
+#define STATS_ENTER(op, len, backend) do { } while (0)
+#define STATS_EXIT(op, len) do { (void)(len); } while (0)
+#define STATS_TAIL(len) do { } while (0)
+
+#else
+
+#define STATS_ENABLED() __builtin_expect (__atomic_load_n (&blabla_stats_on, __ATOMIC_RELAXED), 0)
+
+#define STATS_ENTER(op, len, backend) \
+    do \
+    { \
+        STATS_PROBE (op##_entry, len); \
+        if (STATS_ENABLED ()) \
+            blabla_stats_count (STATS_OP_##op, len, backend); \
+    } while (0)
+
+#define STATS_EXIT(op, len) STATS_PROBE (op##_exit, len)
+
+/* Bytes after the last whole core, which take the partial path */
+#define STATS_TAIL(len) \
+    do \
+    { \
+        if (STATS_ENABLED ()) \
+            blabla_stats_tail (len); \
+    } while (0)
+
+#endif
+
+#endif
@@ -4,9 +4,26 @@
  * Copyright (C) 2017 Nagravision S.A.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "blabla.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #define TEST_LEN 600
+#define LONG_LEN 5000
+#define MT_LEN (3 * 1024 * 1024 + 77)
+/* Above the threshold for non-temporal stores */
+#define NT_LEN (9 * 1024 * 1024 + 77)
+/* Several refills of the per-thread buffer of blabla_rng */
+#define RNG_LEN (1 << 20)
+/* A few cores of every backend and a partial one */
+#define HBLABLA_COUNT 37
+
+__extension__ typedef unsigned __int128 u128;
 
 int memcmp_where (const uint8_t *lhs, const uint8_t *rhs, size_t len)
 {
@@ -25,9 +42,148 @@ int memcmp_where (const uint8_t *lhs, const uint8_t *rhs, size_t len)
     return res;
 }
 
+/* Prints the outcome of one test, returns 1 on failure */
+int check (const char *name, const uint8_t *out, const uint8_t *expected, size_t len)
+{
+    int i;
+    int where = memcmp_where (out, expected, len);
+
+    if (where < 0)
+    {
+        printf ("%s: looks good!\n", name);
+        return 0;
+    }
+
+    printf ("%s: wrong result (first difference at offset 0x%x):\n", name, where);
+    for (i = 0; i < len; ++i)
+    {
+        printf ("0x%02x,", out[i]);
+        if (i % 16 == 15) printf ("\n");
+    }
+    printf ("\n%s: expected:\n", name);
+    for (i = 0; i < len; ++i)
+    {
+        printf ("0x%02x,", expected[i]);
+        if (i % 16 == 15) printf ("\n");
+    }
+    printf ("\n");
+    return 1;
+}
+
+/* Every output length up to TEST_LEN must be a prefix of the full output, so
+ * that all bulk, short-message and partial-store code paths are covered.
+ * Buffers are allocated to the exact length for the sanitizers. */
+int check_lengths (const char *name, const uint8_t *in, const uint8_t *expected,
+                   const uint8_t *n, const uint8_t *k, int rounds)
+{
+    int len;
+
+    for (len = 0; len <= TEST_LEN; ++len)
+    {
+        uint8_t *out = malloc (len + 1);
+        uint8_t *inlen = malloc (len + 1);
+
+        if (in != NULL)
+        {
+            memcpy (inlen, in, len);
+            if (rounds == nROUNDS)
+                blabla_xor (out, inlen, len, n, k);
+            else
+                blabla_xor_rounds (out, inlen, len, n, k, rounds);
+        }
+        else
+        {
+            if (rounds == nROUNDS)
+                blabla_keystream (out, len, n, k);
+            else
+                blabla_keystream_rounds (out, len, n, k, rounds);
+        }
+
+        int failed = memcmp_where (out, expected, len) >= 0;
+        if (failed)
+        {
+            printf ("%s: wrong result for length %d\n", name, len);
+            check (name, out, expected, len);
+        }
+
+        free (inlen);
+        free (out);
+        if (failed)
+            return 1;
+    }
+
+    printf ("%s: looks good!\n", name);
+    return 0;
+}
+
+/* Completion callback of the blabla_engine test */
+static void engine_test_done (blabla_request *req)
+{
+    __atomic_add_fetch ((int *)req->arg, 1, __ATOMIC_RELEASE);
+}
+
+/* Thread-specific data whose destructor runs after those of the library
+ * (keys are destroyed in order of creation), and encrypts again */
+static pthread_key_t late_key;
+
+static void late_destructor (void *arg)
+{
+    uint8_t buf[64] = { 0 };
+
+    if (blabla_xor (buf, buf, sizeof (buf), arg, arg) != 0
+        || blabla_rng_bytes (buf, sizeof (buf)) != 0)
+        *(int *)arg = -1;
+}
+
+static void *late_thread (void *arg)
+{
+    uint8_t buf[64] = { 0 };
+
+    blabla_xor (buf, buf, sizeof (buf), arg, arg);
+    blabla_rng_bytes (buf, sizeof (buf));
+    pthread_key_create (&late_key, late_destructor);
+    pthread_setspecific (late_key, arg);
+    return NULL;
+}
+
+/* FNV-1a, to check long outputs against a digest */
+uint64_t fnv1a (const uint8_t *buf, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+    {
+        h ^= buf[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Digest of the output of blabla_ctxt_keystream/blabla_ctxt_xor called on
+ * 1 MiB chunks, under the threshold for non-temporal stores */
+uint64_t ctxt_digest (const uint8_t *in, uint8_t *out, uint64_t len,
+                      const uint8_t *n, const uint8_t *k)
+{
+    blabla_ctxt ctxt;
+    uint64_t pos, chunk;
+
+    blabla_ctxt_init (&ctxt, k, n);
+    for (pos = 0; pos < len; pos += chunk)
+    {
+        chunk = len - pos < 1024 * 1024 ? len - pos : 1024 * 1024;
+        if (in != NULL)
+            blabla_ctxt_xor (&ctxt, in + pos, out + pos, chunk);
+        else
+            blabla_ctxt_keystream (&ctxt, out + pos, chunk);
+    }
+    return fnv1a (out, len);
+}
+
 int main ()
 {
     int i;
+    int failures = 0;
     uint8_t key[32];
     uint8_t nonce[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
     uint8_t in[TEST_LEN];
@@ -35,6 +191,16 @@ int main ()
     uint8_t blablaxor[TEST_LEN];
 
 #ifdef USE_SHA2_CONSTANTS
+    /* FNV-1a of the LONG_LEN-byte keystream and XOR outputs */
+    const uint64_t blablalong[2] = { 0xc1945f8a8389c397ULL, 0x52333fbc81794de7ULL };
+    /* Same for 6, 8 and 12 double rounds */
+    const uint64_t blablarounds[3][2] = {
+        { 0x2a5f57696d1eda4cULL, 0x53095736e1c859ccULL },
+        { 0xc8e1d39aca6e79d8ULL, 0xde13b874cb3a0e50ULL },
+        { 0xbf91a7f9bb55c930ULL, 0x5ebd832f6ce6d2b4ULL },
+    };
+    /* FNV-1a of the HBLABLA_COUNT subkeys of the hblabla test */
+    const uint64_t hblablalong = 0xf3caad32ddd5ef88ULL;
     const uint8_t blablabla[TEST_LEN] = {
         0x60, 0x72, 0xb5, 0xda, 0x46, 0xcf, 0x88, 0x40, 0xdf, 0x1f, 0xfb, 0x62,
         0x5d, 0xe9, 0x1b, 0xfe, 0xcf, 0x73, 0x1d, 0x1e, 0x09, 0x7d, 0xb1, 0xec,
@@ -88,6 +254,13 @@ int main ()
         0xca, 0x5f, 0x4a, 0xfb, 0x09, 0xe4, 0x81, 0x41, 0x2d, 0xb1, 0x1a, 0xb0,
     };
 #else
+    const uint64_t blablalong[2] = { 0x92a3a87bb8ca20f0ULL, 0xd9d314099efc06ecULL };
+    const uint64_t blablarounds[3][2] = {
+        { 0x8c057dfa294fc310ULL, 0x793e1310f0ccfb80ULL },
+        { 0x7b052690e388c610ULL, 0x6b182dbd1eb4fdbcULL },
+        { 0xf88af050b6146e87ULL, 0xd908b53b7bfae5cfULL },
+    };
+    const uint64_t hblablalong = 0xe4b76668eebd4426ULL;
     const uint8_t blablabla[TEST_LEN] = {
         0xad, 0x50, 0xfe, 0x7b, 0x67, 0xbc, 0xf1, 0xea, 0x10, 0x82, 0x9a, 0xc9,
         0x5f, 0x56, 0x03, 0x63, 0x48, 0xaf, 0xda, 0xee, 0xee, 0x88, 0xb8, 0x14,
@@ -142,6 +315,8 @@ int main ()
     };
 #endif
 
+    printf ("backend: %s\n", blabla_backend_name ());
+
     for (i = 0; i < TEST_LEN; ++i)
     {
         in[i] = i;
@@ -155,54 +330,1001 @@ int main ()
 
     /* blabla_keystream */
     blabla_keystream (out, TEST_LEN, nonce, key);
+    failures += check ("blabla_keystream", out, blablabla, TEST_LEN);
 
-    int where = memcmp_where (out, blablabla, TEST_LEN);
-    if (where < 0)
+    /* blabla_xor */
+    blabla_xor (out, in, TEST_LEN, nonce, key);
+    failures += check ("blabla_xor", out, blablaxor, TEST_LEN);
+
+    failures += check_lengths ("blabla_keystream (all lengths)", NULL, blablabla, nonce, key, nROUNDS);
+    failures += check_lengths ("blabla_xor (all lengths)", in, blablaxor, nonce, key, nROUNDS);
+
+    /* Long outputs go through the bulk path of every backend */
     {
-        printf ("blabla_keystream: looks good!\n");
+        uint8_t *longin = malloc (LONG_LEN);
+        uint8_t *longout = malloc (LONG_LEN);
+        uint64_t h[2];
+
+        for (i = 0; i < LONG_LEN; ++i)
+            longin[i] = i;
+
+        blabla_keystream (longout, LONG_LEN, nonce, key);
+        h[0] = fnv1a (longout, LONG_LEN);
+        blabla_xor (longout, longin, LONG_LEN, nonce, key);
+        h[1] = fnv1a (longout, LONG_LEN);
+        failures += check ("blabla_keystream/blabla_xor (long)", (const uint8_t *)h,
+                           (const uint8_t *)blablalong, sizeof (h));
+
+        free (longin);
+        free (longout);
     }
-    else
+
+    /* Prepared keys: every length, then the long output */
     {
-        printf (
-        "blabla_keystream: wrong result (first difference at offset 0x%x):\n", where);
-        for (i = 0; i < TEST_LEN; ++i)
+        blabla_key pk;
+        uint8_t *longin = malloc (LONG_LEN);
+        uint8_t *longout = malloc (LONG_LEN);
+        uint8_t *expected = malloc (LONG_LEN);
+        int failed = 0;
+        int len;
+
+        blabla_key_init (&pk, key);
+        for (len = 0; len <= TEST_LEN && !failed; ++len)
         {
-            printf ("0x%02x,", out[i]);
-            if (i % 16 == 15) printf ("\n");
+            uint8_t *o = malloc (len + 1);
+            uint8_t *x = malloc (len + 1);
+
+            memcpy (x, in, len);
+            blabla_keystream_with_key (o, len, nonce, &pk);
+            failed |= memcmp (o, blablabla, len) != 0;
+            blabla_xor_with_key (o, x, len, nonce, &pk);
+            failed |= memcmp (o, blablaxor, len) != 0;
+            if (failed)
+                printf ("blabla_xor_with_key: wrong result for length %d\n", len);
+            free (o);
+            free (x);
         }
-        printf ("\nblabla_keystream: expected:\n");
-        for (i = 0; i < TEST_LEN; ++i)
+
+        for (i = 0; i < LONG_LEN; ++i)
+            longin[i] = i;
+        blabla_xor (expected, longin, LONG_LEN, nonce, key);
+        blabla_xor_with_key (longout, longin, LONG_LEN, nonce, &pk);
+        failed |= memcmp (longout, expected, LONG_LEN) != 0;
+        blabla_keystream (expected, LONG_LEN, nonce, key);
+        blabla_keystream_with_key (longout, LONG_LEN, nonce, &pk);
+        failed |= memcmp (longout, expected, LONG_LEN) != 0;
+
+        if (!failed)
+            printf ("blabla_xor_with_key: looks good!\n");
+        failures += failed;
+
+        blabla_key_wipe (&pk);
+        free (longin);
+        free (longout);
+        free (expected);
+    }
+
+    /* Other round counts: long digests, then every length against a prefix of
+     * the long output */
+    {
+        static const int rounds[3] = { 6, 8, 12 };
+        static const char *names[3][2] = {
+            { "blabla6_keystream", "blabla6_xor" },
+            { "blabla8_keystream", "blabla8_xor" },
+            { "blabla12_keystream", "blabla12_xor" },
+        };
+        uint8_t *longin = malloc (LONG_LEN);
+        uint8_t *longks = malloc (LONG_LEN);
+        uint8_t *longxor = malloc (LONG_LEN);
+        uint64_t h[2];
+        int r;
+
+        for (i = 0; i < LONG_LEN; ++i)
+            longin[i] = i;
+
+        for (r = 0; r < 3; ++r)
         {
-            printf ("0x%02x,", blablabla[i]);
-            if (i % 16 == 15) printf ("\n");
+            if (rounds[r] == 6)
+            {
+                blabla6_keystream (longks, LONG_LEN, nonce, key);
+                blabla6_xor (longxor, longin, LONG_LEN, nonce, key);
+            }
+            else if (rounds[r] == 8)
+            {
+                blabla8_keystream (longks, LONG_LEN, nonce, key);
+                blabla8_xor (longxor, longin, LONG_LEN, nonce, key);
+            }
+            else
+            {
+                blabla12_keystream (longks, LONG_LEN, nonce, key);
+                blabla12_xor (longxor, longin, LONG_LEN, nonce, key);
+            }
+            h[0] = fnv1a (longks, LONG_LEN);
+            h[1] = fnv1a (longxor, LONG_LEN);
+            failures += check (names[r][0], (const uint8_t *)h, (const uint8_t *)blablarounds[r], sizeof (h));
+
+            failures += check_lengths (names[r][0], NULL, longks, nonce, key, rounds[r]);
+            failures += check_lengths (names[r][1], longin, longxor, nonce, key, rounds[r]);
         }
-        printf ("\n");
+
+        free (longin);
+        free (longks);
+        free (longxor);
     }
 
-    /* blabla_xor */
-    blabla_xor (out, in, TEST_LEN, nonce, key);
+    /* blabla_ctxt: calls on whole blocks continue the keystream */
+    {
+        blabla_ctxt ctxt;
 
-    where = memcmp_where (out, blablaxor, TEST_LEN);
-    if (where < 0)
+        blabla_ctxt_init (&ctxt, key, nonce);
+        blabla_ctxt_keystream (&ctxt, out, 3 * BLOCK_LEN);
+        blabla_ctxt_keystream (&ctxt, out + 3 * BLOCK_LEN, BLOCK_LEN);
+        blabla_ctxt_xor (&ctxt, in + 4 * BLOCK_LEN, out + 4 * BLOCK_LEN, TEST_LEN - 4 * BLOCK_LEN);
+        for (i = 0; i < 4 * BLOCK_LEN; ++i)
+            out[i] ^= in[i];
+        failures += check ("blabla_ctxt_xor", out, blablaxor, TEST_LEN);
+    }
+
+    /* blabla_stream: chunks of arbitrary sizes */
+    {
+        static const uint64_t chunks[] = { 1, 63, 130, 1000, 1, 2049, 17, 512, 1024, 5 };
+        blabla_stream stream;
+        uint8_t *longin = malloc (LONG_LEN);
+        uint8_t *longout = malloc (LONG_LEN);
+        uint8_t *expected = malloc (LONG_LEN);
+        uint64_t pos, n;
+
+        for (i = 0; i < LONG_LEN; ++i)
+            longin[i] = i;
+        blabla_xor (expected, longin, LONG_LEN, nonce, key);
+
+        blabla_stream_init (&stream, nonce, key);
+        for (pos = 0, i = 0; pos < LONG_LEN; pos += n, ++i)
+        {
+            n = chunks[i % (sizeof (chunks) / sizeof (chunks[0]))];
+            if (n > LONG_LEN - pos)
+                n = LONG_LEN - pos;
+            blabla_stream_update (&stream, longin + pos, longout + pos, n);
+        }
+        blabla_stream_final (&stream);
+        failures += check ("blabla_stream_update", longout, expected, LONG_LEN);
+
+        /* blabla_xorv: input and output cut at different places, with empty
+         * fragments, then in place */
+        {
+            static const uint64_t incuts[] = { 0, 54, 1400, 0, 3, 700, 2048, 1 };
+            static const uint64_t outcuts[] = { 1, 1023, 129, 5000, 0, 17 };
+            struct iovec iin[64], iout[64];
+            int inc, outc;
+
+            for (pos = 0, inc = 0; pos < LONG_LEN; pos += n, ++inc)
+            {
+                n = incuts[inc % (sizeof (incuts) / sizeof (incuts[0]))];
+                if (n > LONG_LEN - pos || inc == 63)
+                    n = LONG_LEN - pos;
+                iin[inc].iov_base = longin + pos;
+                iin[inc].iov_len = n;
+            }
+            for (pos = 0, outc = 0; pos < LONG_LEN; pos += n, ++outc)
+            {
+                n = outcuts[outc % (sizeof (outcuts) / sizeof (outcuts[0]))];
+                if (n > LONG_LEN - pos || outc == 63)
+                    n = LONG_LEN - pos;
+                iout[outc].iov_base = longout + pos;
+                iout[outc].iov_len = n;
+            }
+
+            memset (longout, 0, LONG_LEN);
+            if (blabla_xorv (iin, inc, iout, outc, nonce, key) != 0
+                || blabla_xorv (iin, inc, iout, outc - 1, nonce, key) != -1)
+                memset (longout, 0, LONG_LEN);
+            failures += check ("blabla_xorv", longout, expected, LONG_LEN);
+
+            memcpy (longout, longin, LONG_LEN);
+            for (i = 0; i < inc; ++i)
+                iin[i].iov_base = longout + ((uint8_t *)iin[i].iov_base - longin);
+            blabla_xorv (iin, inc, iin, inc, nonce, key);
+            failures += check ("blabla_xorv in place", longout, expected, LONG_LEN);
+        }
+
+        /* blabla_xor_at: ranges starting anywhere in a block */
+        {
+            static const uint64_t offsets[] = { 0, 1, 127, 128, 200, 1023, 1024, 1100, 4000 };
+            int failed = 0;
+            unsigned j;
+
+            for (j = 0; j < sizeof (offsets) / sizeof (offsets[0]); ++j)
+            {
+                uint64_t off = offsets[j];
+
+                for (n = 0; off + n <= LONG_LEN; n += 1 + n / 2)
+                {
+                    memset (longout, 0, LONG_LEN);
+                    blabla_xor_at (longout + off, longin + off, n, off, nonce, key);
+                    if (memcmp (longout + off, expected + off, n) != 0)
+                    {
+                        printf ("blabla_xor_at: wrong result at offset %d, length %d\n",
+                                (int)off, (int)n);
+                        failed = 1;
+                        break;
+                    }
+                }
+            }
+            if (!failed)
+                printf ("blabla_xor_at: looks good!\n");
+            failures += failed;
+        }
+
+        free (longin);
+        free (longout);
+        free (expected);
+    }
+
+    /* blabla_xor_batch: messages of unequal lengths under different keys */
     {
-        printf ("blabla_xor: looks good!\n");
+        static const uint64_t lens[] = { 256, 1, 0, 128, 129, 600, 3000, 255, 64, 1024, 17 };
+        blabla_job jobs[37];
+        uint8_t keys[37][32];
+        uint8_t nonces[37][16];
+        uint8_t *longin = malloc (37 * 3000);
+        uint8_t *longout = malloc (37 * 3000);
+        uint8_t *expected = malloc (37 * 3000);
+        uint64_t pos = 0;
+
+        for (i = 0; i < 37 * 3000; ++i)
+            longin[i] = i;
+        for (i = 0; i < 37; ++i)
+        {
+            int j;
+
+            for (j = 0; j < 32; ++j)
+                keys[i][j] = i + j;
+            for (j = 0; j < 16; ++j)
+                nonces[i][j] = i * j;
+            jobs[i].key = keys[i];
+            jobs[i].nonce = nonces[i];
+            jobs[i].in = longin + pos;
+            jobs[i].out = longout + pos;
+            jobs[i].len = lens[i % (sizeof (lens) / sizeof (lens[0]))];
+            blabla_xor (expected + pos, longin + pos, jobs[i].len, nonces[i], keys[i]);
+            pos += jobs[i].len;
+        }
+
+        blabla_xor_batch (jobs, 37);
+        failures += check ("blabla_xor_batch", longout, expected, pos);
+
+        free (longin);
+        free (longout);
+        free (expected);
     }
-    else
+
+    /* blabla_xor_sectors: nonce from the sector index, sizes not a multiple
+     * of the block */
     {
-        printf ("blabla_xor: wrong result (first difference at offset 0x%x):\n", where);
-        for (i = 0; i < TEST_LEN; ++i)
+        static const uint64_t sizes[] = { 4096, 300, 1 };
+        uint8_t *sectors = malloc (19 * 4096);
+        uint8_t *expected = malloc (19 * 4096);
+        int failed = 0;
+        unsigned j;
+
+        for (j = 0; j < sizeof (sizes) / sizeof (sizes[0]); ++j)
         {
-            printf ("0x%02x,", out[i]);
-            if (i % 16 == 15) printf ("\n");
+            uint64_t size = sizes[j];
+            uint64_t s;
+
+            for (i = 0; i < 19 * size; ++i)
+                sectors[i] = i;
+            for (s = 0; s < 19; ++s)
+            {
+                uint64_t sector_nonce[2] = { 1000 + s, 0 };
+
+                blabla_xor (expected + s * size, sectors + s * size, size,
+                            (const uint8_t *)sector_nonce, key);
+            }
+            blabla_xor_sectors (sectors, 19, size, 1000, key);
+            if (memcmp (sectors, expected, 19 * size) != 0)
+            {
+                printf ("blabla_xor_sectors: wrong result for %d-byte sectors\n", (int)size);
+                failed = 1;
+            }
         }
-        printf ("\nblabla_xor: expected:\n");
-        for (i = 0; i < TEST_LEN; ++i)
+        if (!failed)
+            printf ("blabla_xor_sectors: looks good!\n");
+        failures += failed;
+
+        free (sectors);
+        free (expected);
+    }
+
+    /* Non-temporal stores: one large call against the same output from calls
+     * small enough for the regular stores, with in aligned and misaligned */
+    {
+        uint8_t *longin = malloc (NT_LEN + 128);
+        uint8_t *longout = malloc (NT_LEN + 128);
+        uint8_t *in64 = longin + (64 - (uintptr_t)longin % 64);
+        uint8_t *out64 = longout + (64 - (uintptr_t)longout % 64);
+        uint64_t h[2];
+        int misalign;
+
+        for (i = 0; i < NT_LEN + 1; ++i)
+            in64[i] = i;
+
+        blabla_keystream (out64, NT_LEN, nonce, key);
+        h[0] = fnv1a (out64, NT_LEN);
+        h[1] = ctxt_digest (NULL, out64, NT_LEN, nonce, key);
+        failures += check ("blabla_keystream (non-temporal)", (const uint8_t *)&h[0],
+                           (const uint8_t *)&h[1], sizeof (h[0]));
+
+        for (misalign = 0; misalign < 2; ++misalign)
         {
-            printf ("0x%02x,", blablaxor[i]);
-            if (i % 16 == 15) printf ("\n");
+            blabla_xor (out64, in64 + misalign, NT_LEN, nonce, key);
+            h[0] = fnv1a (out64, NT_LEN);
+            h[1] = ctxt_digest (in64 + misalign, out64, NT_LEN, nonce, key);
+            failures += check (misalign ? "blabla_xor (non-temporal, unaligned in)" : "blabla_xor (non-temporal)",
+                               (const uint8_t *)&h[0], (const uint8_t *)&h[1], sizeof (h[0]));
         }
-        printf ("\n");
+
+        free (longin);
+        free (longout);
     }
 
-    return 0;
+    /* blabla_xor_mt: large enough to be split across threads */
+    {
+        uint8_t *longin = malloc (MT_LEN);
+        uint8_t *longout = malloc (MT_LEN);
+        uint64_t h[2];
+
+        for (i = 0; i < MT_LEN; ++i)
+            longin[i] = i;
+
+        blabla_xor (longout, longin, MT_LEN, nonce, key);
+        h[0] = fnv1a (longout, MT_LEN);
+        blabla_xor_mt (longout, longin, MT_LEN, nonce, key, 4);
+        h[1] = fnv1a (longout, MT_LEN);
+        failures += check ("blabla_xor_mt", (const uint8_t *)&h[1], (const uint8_t *)&h[0], sizeof (h[0]));
+
+        free (longin);
+        free (longout);
+    }
+
+    /* blabla_engine: small requests under two keys, to be batched, and a
+     * large one to be split, completed by callback, pipe or polling */
+    {
+        static const uint64_t lens[] = { 0, 1, 100, 128, 600, 1000, 4096, 4097, 5000 };
+#define ENGINE_TEST_COUNT 40
+        blabla_request reqs[ENGINE_TEST_COUNT];
+        uint8_t nonces[ENGINE_TEST_COUNT][16];
+        uint8_t key2[32];
+        uint8_t *longin = malloc (MT_LEN);
+        uint8_t *longout = malloc (2 * MT_LEN);
+        uint8_t *expected = malloc (2 * MT_LEN);
+        blabla_engine *engine = blabla_engine_create (3, 16);
+        blabla_engine_stats stats;
+        uint64_t pos, total;
+        int callbacks = 0, ncallbacks = 0, npipe = 0, failed = 0;
+        int fds[2];
+
+        for (i = 0; i < MT_LEN; ++i)
+            longin[i] = i;
+        for (i = 0; i < 32; ++i)
+            key2[i] = key[i] ^ 0x5a;
+        if (engine == NULL || pipe (fds) != 0)
+        {
+            printf ("blabla_engine: cannot start\n");
+            return 1;
+        }
+
+        for (i = 0, pos = 0; i < ENGINE_TEST_COUNT; ++i)
+        {
+            blabla_request *req = &reqs[i];
+            uint64_t len = i == 17 ? MT_LEN : lens[i % (sizeof (lens) / sizeof (lens[0]))];
+
+            memset (nonces[i], 0, 16);
+            nonces[i][0] = i;
+            req->job.key = i % 3 ? key : key2;
+            req->job.nonce = nonces[i];
+            req->job.in = longin;
+            req->job.out = longout + pos;
+            req->job.len = len;
+            blabla_xor (expected + pos, longin, len, nonces[i], req->job.key);
+            pos += len;
+
+            req->done = NULL;
+            req->arg = &callbacks;
+            req->fd = -1;
+            if (i % 4 == 1)
+            {
+                req->done = engine_test_done;
+                ++ncallbacks;
+            }
+            else if (i % 4 == 2)
+            {
+                req->fd = fds[1];
+                ++npipe;
+            }
+
+            /* The queue holds 16 entries: wait for room */
+            while (blabla_engine_submit (engine, req) != 0)
+                sched_yield ();
+        }
+        total = pos;
+
+        for (i = 0; i < npipe; ++i)
+        {
+            uint64_t one;
+
+            if (read (fds[0], &one, sizeof (one)) != sizeof (one) || one != 1)
+                failed = 1;
+        }
+        while (__atomic_load_n (&callbacks, __ATOMIC_ACQUIRE) < ncallbacks)
+            sched_yield ();
+        for (i = 0; i < ENGINE_TEST_COUNT; ++i)
+        {
+            if (reqs[i].done == NULL)
+                while (!blabla_request_done (&reqs[i]))
+                    sched_yield ();
+        }
+
+        blabla_engine_get_stats (engine, &stats);
+        blabla_engine_destroy (engine);
+        close (fds[0]);
+        close (fds[1]);
+        if (failed || stats.completed != ENGINE_TEST_COUNT || stats.submitted != ENGINE_TEST_COUNT
+            || stats.depth != 0)
+        {
+            printf ("blabla_engine: wrong completions or statistics\n");
+            memset (longout, 0, total);
+        }
+        failures += check ("blabla_engine", longout, expected, total);
+
+        free (longin);
+        free (longout);
+        free (expected);
+    }
+
+    /* blabla_ring: packets against one blabla_xor of their concatenation,
+     * refilled when idle with gaps long enough to drain the ring, then by
+     * the background thread. The first packets, before any refill, are
+     * served from the slots written at creation. */
+    {
+        static const uint64_t lens[] = { 1, 64, 700, 1400, 1500, 3000, 5000 };
+#define RING_TEST_PACKETS 200
+        uint8_t *longin = malloc (MT_LEN);
+        uint8_t *longout = malloc (MT_LEN);
+        uint8_t *expected = malloc (MT_LEN);
+        int background;
+
+        for (i = 0; i < MT_LEN; ++i)
+            longin[i] = i;
+
+        for (background = 0; background < 2; ++background)
+        {
+            blabla_ring *ring = blabla_ring_create (nonce, key, 16384, background);
+            blabla_ring_stats stats;
+            uint64_t pos, first = 0;
+
+            if (ring == NULL)
+            {
+                printf ("blabla_ring: cannot start\n");
+                return 1;
+            }
+            for (i = 0, pos = 0; i < RING_TEST_PACKETS; ++i)
+            {
+                uint64_t len = lens[i % (sizeof (lens) / sizeof (lens[0]))];
+
+                if (!background && i % 16 >= 12)
+                    blabla_ring_fill (ring);
+                blabla_ring_xor (ring, longin + pos, longout + pos, len);
+                pos += len;
+                if (i == 11)
+                {
+                    blabla_ring_get_stats (ring, &stats);
+                    first = stats.ring_bytes == pos;
+                }
+            }
+            blabla_ring_get_stats (ring, &stats);
+            blabla_ring_destroy (ring);
+
+            blabla_xor (expected, longin, pos, nonce, key);
+            if (stats.ring_bytes + stats.inline_bytes != pos
+                || (!background && (!first || stats.ring_bytes == 0 || stats.inline_bytes == 0)))
+            {
+                printf ("blabla_ring: wrong statistics\n");
+                memset (longout, 0, pos);
+            }
+            failures += check (background ? "blabla_ring (background)" : "blabla_ring (idle)",
+                               longout, expected, pos);
+        }
+
+        free (longin);
+        free (longout);
+        free (expected);
+    }
+
+    /* blabla_stats: counters of this thread around one call of each kind,
+     * then nothing counted once disabled */
+    {
+        blabla_stats before, after, all;
+        uint64_t counts[2][4];
+
+        blabla_stats_enable (1);
+        blabla_stats_thread (&before);
+        blabla_xor (out, in, TEST_LEN, nonce, key);
+        blabla_keystream (out, 300, nonce, key);
+        blabla_stats_thread (&after);
+        blabla_stats_snapshot (&all);
+        blabla_stats_enable (0);
+        blabla_xor (out, in, TEST_LEN, nonce, key);
+
+        counts[0][0] = after.xor_calls - before.xor_calls;
+        counts[0][1] = after.xor_bytes - before.xor_bytes;
+        counts[0][2] = after.keystream_calls - before.keystream_calls;
+        counts[0][3] = after.keystream_bytes - before.keystream_bytes;
+        counts[1][0] = 1;
+        counts[1][1] = TEST_LEN;
+        counts[1][2] = 1;
+        counts[1][3] = 300;
+        blabla_stats_thread (&before);
+        if (after.tail_bytes == 0 || after.tail_bytes > after.xor_bytes + after.keystream_bytes
+            || all.xor_bytes < after.xor_bytes || before.xor_calls != after.xor_calls
+            || strcmp (after.backend, blabla_backend_name ()))
+        {
+            printf ("blabla_stats: wrong tail, snapshot or backend\n");
+            counts[0][0] = 0;
+        }
+        failures += check ("blabla_stats", (const uint8_t *)counts[0], (const uint8_t *)counts[1],
+                           sizeof (counts[0]));
+    }
+
+    /* blabla_stats, blabla_rng_bytes: a thread that still encrypts and
+     * draws from a destructor of its own, after its counters and generator
+     * were freed, gets new ones and is counted again */
+    {
+        blabla_stats before, after;
+        uint8_t late[32] = { 0 };
+        pthread_t thread;
+
+        blabla_stats_enable (1);
+        blabla_stats_snapshot (&before);
+        if (pthread_create (&thread, NULL, late_thread, late) == 0)
+            pthread_join (thread, NULL);
+        pthread_key_delete (late_key);
+        blabla_stats_snapshot (&after);
+        blabla_stats_enable (0);
+
+        if (late[0] != 0 || after.xor_calls - before.xor_calls != 2)
+        {
+            printf ("blabla_stats: wrong result after thread exit\n");
+            ++failures;
+        }
+        else
+        {
+            printf ("blabla_stats: thread exit looks good!\n");
+        }
+    }
+
+
+    /* blabla_poly1305: RFC 8439, section 2.5.2 */
+    {
+        static const uint8_t polykey[32] = {
+            0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33, 0x7f, 0x44, 0x52,
+            0xfe, 0x42, 0xd5, 0x06, 0xa8, 0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d,
+            0xb2, 0xfd, 0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b,
+        };
+        static const uint8_t polytag[16] = {
+            0xa8, 0x06, 0x1d, 0xc1, 0x30, 0x51, 0x36, 0xc6,
+            0xc2, 0x2b, 0x8b, 0xaf, 0x0c, 0x01, 0x27, 0xa9,
+        };
+        const char *msg = "Cryptographic Forum Research Group";
+        uint8_t tag[16];
+
+        blabla_poly1305 (tag, (const uint8_t *)msg, strlen (msg), polykey);
+        failures += check ("blabla_poly1305", tag, polytag, 16);
+    }
+
+    /* blabla_aead: against blabla_xor and blabla_poly1305 on the MAC input
+     * of RFC 8439, for lengths around the SIMD groups and cores. Half of the
+     * bytes are 0xff to push the limbs to their bounds. */
+    {
+        static const uint64_t adlens[] = { 0, 1, 16, 129, 300 };
+        static const uint64_t mlens[] = { 0, 1, 15, 16, 17, 255, 256, 511, 512, 1023, 1024, 1025, 2048, 3000, 4097 };
+        uint8_t *msg = malloc (4097);
+        uint8_t *ad = malloc (300);
+        uint8_t *ct = malloc (4097);
+        uint8_t *pt = malloc (4097);
+        uint8_t *expected = malloc (4097);
+        uint8_t *macdata = malloc (320 + 4112 + 16);
+        uint8_t tag[16], exptag[16], polykey[32];
+        blabla_ctxt ctxt;
+        int failed = 0;
+        unsigned a, m;
+
+        for (i = 0; i < 4097; ++i)
+            msg[i] = (i / 64) % 2 ? 0xff : i * 7;
+        for (i = 0; i < 300; ++i)
+            ad[i] = i % 3 ? 0xff : i;
+
+        blabla_ctxt_init (&ctxt, key, nonce);
+        ctxt.counter[1] = 0;
+        blabla_ctxt_keystream (&ctxt, polykey, 32);
+
+        for (a = 0; a < sizeof (adlens) / sizeof (adlens[0]); ++a)
+        {
+            for (m = 0; m < sizeof (mlens) / sizeof (mlens[0]); ++m)
+            {
+                uint64_t adlen = adlens[a], mlen = mlens[m];
+                uint64_t pos = 0;
+
+                blabla_aead_encrypt (ct, tag, msg, mlen, ad, adlen, nonce, key);
+
+                blabla_xor (expected, msg, mlen, nonce, key);
+                memset (macdata, 0, 320 + 4112 + 16);
+                memcpy (macdata, ad, adlen);
+                pos = (adlen + 15) / 16 * 16;
+                memcpy (macdata + pos, expected, mlen);
+                pos += (mlen + 15) / 16 * 16;
+                for (i = 0; i < 8; ++i)
+                {
+                    macdata[pos + i] = adlen >> (8 * i);
+                    macdata[pos + 8 + i] = mlen >> (8 * i);
+                }
+                blabla_poly1305 (exptag, macdata, pos + 16, polykey);
+
+                if (memcmp (ct, expected, mlen) != 0 || memcmp (tag, exptag, 16) != 0)
+                {
+                    printf ("blabla_aead_encrypt: wrong result for ad %d, message %d\n", (int)adlen, (int)mlen);
+                    failed = 1;
+                }
+
+                if (blabla_aead_decrypt (pt, ct, mlen, tag, ad, adlen, nonce, key) != 0
+                    || memcmp (pt, msg, mlen) != 0)
+                {
+                    printf ("blabla_aead_decrypt: wrong result for ad %d, message %d\n", (int)adlen, (int)mlen);
+                    failed = 1;
+                }
+
+                /* In place */
+                memcpy (pt, msg, mlen);
+                blabla_aead_encrypt (pt, exptag, pt, mlen, ad, adlen, nonce, key);
+                if (memcmp (pt, ct, mlen) != 0 || memcmp (exptag, tag, 16) != 0
+                    || blabla_aead_decrypt (pt, pt, mlen, tag, ad, adlen, nonce, key) != 0
+                    || memcmp (pt, msg, mlen) != 0)
+                {
+                    printf ("blabla_aead: wrong in-place result for ad %d, message %d\n", (int)adlen, (int)mlen);
+                    failed = 1;
+                }
+
+                /* Forgeries are rejected and the output wiped */
+                if (mlen > 0)
+                    ct[mlen / 2] ^= 1;
+                else
+                    tag[0] ^= 1;
+                memset (pt, 0xaa, mlen);
+                if (blabla_aead_decrypt (pt, ct, mlen, tag, ad, adlen, nonce, key) != -1)
+                {
+                    printf ("blabla_aead_decrypt: forgery accepted for ad %d, message %d\n", (int)adlen, (int)mlen);
+                    failed = 1;
+                }
+                for (i = 0; i < mlen; ++i)
+                {
+                    if (pt[i] != 0)
+                    {
+                        printf ("blabla_aead_decrypt: output not wiped for ad %d, message %d\n", (int)adlen, (int)mlen);
+                        failed = 1;
+                        break;
+                    }
+                }
+            }
+        }
+        if (!failed)
+            printf ("blabla_aead: looks good!\n");
+        failures += failed;
+
+        free (msg);
+        free (ad);
+        free (ct);
+        free (pt);
+        free (expected);
+        free (macdata);
+    }
+
+    /* blabla_permute: block states with feed-forward give the keystream, and
+     * without it the same minus the input; SoA gives the same as AoS. The
+     * counts cover full and partial groups of every backend. */
+    {
+        uint64_t *input = malloc (HBLABLA_COUNT * 128);
+        uint64_t *aos = malloc (HBLABLA_COUNT * 128);
+        uint64_t *soa = malloc (HBLABLA_COUNT * 128);
+        uint8_t *expected = malloc (HBLABLA_COUNT * 128);
+        blabla_ctxt ctxt;
+        int failed = 0;
+        int c, s, w, ff;
+
+        blabla_ctxt_init (&ctxt, key, nonce);
+        blabla_ctxt_keystream (&ctxt, expected, HBLABLA_COUNT * 128);
+
+        for (c = 1; c <= HBLABLA_COUNT; c += c < 9 ? 1 : 7)
+        {
+            for (s = 0; s < c; ++s)
+            {
+                memcpy (&input[16 * s], constants, 32);
+                memcpy (&input[16 * s + 4], key, 32);
+                memcpy (&input[16 * s + 8], &constants[4], 32);
+                input[16 * s + 12] = constants[8];
+                input[16 * s + 13] = 1 + s;
+                memcpy (&input[16 * s + 14], nonce, 16);
+            }
+
+            for (ff = 1; ff >= 0; --ff)
+            {
+                int flags = ff ? BLABLA_PERMUTE_FEEDFORWARD : 0;
+
+                memcpy (aos, input, c * 128);
+                for (s = 0; s < c; ++s)
+                    for (w = 0; w < 16; ++w)
+                        soa[w * c + s] = input[16 * s + w];
+
+                blabla_permute (aos, c, flags);
+                blabla_permute (soa, c, flags | BLABLA_PERMUTE_SOA);
+
+                for (s = 0; s < c * 16; ++s)
+                {
+                    uint64_t ks;
+
+                    memcpy (&ks, expected + 8 * s, 8);
+                    if (aos[s] != (ff ? ks : ks - input[s])
+                        || soa[(s % 16) * c + s / 16] != aos[s])
+                    {
+                        printf ("blabla_permute: wrong result for %d states, flags %d\n", c, flags);
+                        failed = 1;
+                        break;
+                    }
+                }
+            }
+        }
+        if (!failed)
+            printf ("blabla_permute: looks good!\n");
+        failures += failed;
+
+        free (input);
+        free (aos);
+        free (soa);
+        free (expected);
+    }
+
+    /* hblabla: digest of the batch, then every subkey and every batch size
+     * against hblabla alone. xblabla: against blabla under the subkey. */
+    {
+        uint8_t *hin = malloc (HBLABLA_COUNT * 16);
+        uint8_t *subkeys = malloc (HBLABLA_COUNT * 32);
+        uint8_t subkey[32], tag[16], exptag[16];
+        uint8_t expected[TEST_LEN], pt[TEST_LEN];
+        uint64_t h;
+        int failed = 0;
+        int c;
+
+        for (i = 0; i < HBLABLA_COUNT * 16; ++i)
+            hin[i] = i * 7;
+
+        hblabla_batch (subkeys, hin, HBLABLA_COUNT, key);
+        h = fnv1a (subkeys, HBLABLA_COUNT * 32);
+        failures += check ("hblabla_batch", (const uint8_t *)&h, (const uint8_t *)&hblablalong, sizeof (h));
+
+        for (c = 1; c <= HBLABLA_COUNT; ++c)
+        {
+            uint8_t *exact = malloc (c * 32);
+
+            hblabla (subkey, hin + 16 * (c - 1), key);
+            hblabla_batch (exact, hin, c, key);
+            if (memcmp (subkey, subkeys + 32 * (c - 1), 32) != 0 || memcmp (exact, subkeys, c * 32) != 0)
+            {
+                printf ("hblabla: wrong result for %d inputs\n", c);
+                failed = 1;
+            }
+            free (exact);
+        }
+        if (!failed)
+            printf ("hblabla: looks good!\n");
+        failures += failed;
+
+        /* The extended nonce is the first two inputs */
+        hblabla (subkey, hin, key);
+        xblabla_keystream (out, TEST_LEN, hin, key);
+        blabla_keystream (expected, TEST_LEN, hin + 16, subkey);
+        failures += check ("xblabla_keystream", out, expected, TEST_LEN);
+
+        xblabla_xor (out, in, TEST_LEN, hin, key);
+        blabla_xor (expected, in, TEST_LEN, hin + 16, subkey);
+        failures += check ("xblabla_xor", out, expected, TEST_LEN);
+
+        xblabla_aead_encrypt (out, tag, in, TEST_LEN, key, 32, hin, key);
+        blabla_aead_encrypt (expected, exptag, in, TEST_LEN, key, 32, hin + 16, subkey);
+        failed = memcmp (out, expected, TEST_LEN) != 0 || memcmp (tag, exptag, 16) != 0
+                 || xblabla_aead_decrypt (pt, out, TEST_LEN, tag, key, 32, hin, key) != 0
+                 || memcmp (pt, in, TEST_LEN) != 0;
+        tag[0] ^= 1;
+        failed |= xblabla_aead_decrypt (pt, out, TEST_LEN, tag, key, 32, hin, key) != -1;
+        if (failed)
+            printf ("xblabla_aead: wrong result\n");
+        else
+            printf ("xblabla_aead: looks good!\n");
+        failures += failed;
+
+        free (hin);
+        free (subkeys);
+    }
+
+    /* blabla_prng: the keystream as 64-bit words, whatever the split into
+     * calls, jumps and conversions */
+    {
+        static const uint64_t draws[] = { 1, 200, 3, 16, 1000, 5, 129, 2 };
+        static const uint64_t jumps[] = { 0, 1, 15, 16, 17, 127, 128, 129, 1000, 3333 };
+        uint64_t *expected = malloc (LONG_LEN * 8);
+        uint64_t *words = malloc (LONG_LEN * 8);
+        double *doubles = malloc (LONG_LEN * sizeof (double));
+        uint64_t stream_nonce[2] = { 7, 0 };
+        blabla_prng rng;
+        uint64_t pos, n;
+        int failed = 0;
+        unsigned j;
+
+        blabla_keystream ((uint8_t *)expected, LONG_LEN * 8, (const uint8_t *)stream_nonce, key);
+
+        blabla_prng_init (&rng, key, 7);
+        for (pos = 0, i = 0; pos < LONG_LEN; pos += n, ++i)
+        {
+            n = draws[i % (sizeof (draws) / sizeof (draws[0]))];
+            if (n > LONG_LEN - pos)
+                n = LONG_LEN - pos;
+            if (n == 1)
+                words[pos] = blabla_prng_u64 (&rng);
+            else
+                blabla_prng_fill_u64 (&rng, words + pos, n);
+        }
+        failures += check ("blabla_prng_fill_u64", (const uint8_t *)words, (const uint8_t *)expected, LONG_LEN * 8);
+
+        blabla_prng_init (&rng, key, 7);
+        for (pos = 0, i = 0; pos < LONG_LEN; pos += n, ++i)
+        {
+            n = draws[i % (sizeof (draws) / sizeof (draws[0]))];
+            if (n > LONG_LEN - pos)
+                n = LONG_LEN - pos;
+            if (n == 1)
+                doubles[pos] = blabla_prng_double (&rng);
+            else
+                blabla_prng_fill_double (&rng, doubles + pos, n);
+        }
+        for (pos = 0; pos < LONG_LEN; ++pos)
+        {
+            if (doubles[pos] != (double)(expected[pos] >> 12) / 4503599627370496.0)
+                failed = 1;
+        }
+        if (failed)
+            printf ("blabla_prng_fill_double: wrong result\n");
+
+        for (j = 0; j < sizeof (jumps) / sizeof (jumps[0]); ++j)
+        {
+            /* from a fresh generator, and after a few buffered words */
+            blabla_prng_init (&rng, key, 7);
+            blabla_prng_jump (&rng, jumps[j]);
+            blabla_prng_fill_u64 (&rng, words, 300);
+            if (memcmp (words, expected + jumps[j], 300 * 8) != 0)
+                failed = 1;
+
+            blabla_prng_init (&rng, key, 7);
+            blabla_prng_u64 (&rng);
+            blabla_prng_jump (&rng, jumps[j]);
+            if (blabla_prng_u64 (&rng) != expected[jumps[j] + 1])
+                failed = 1;
+        }
+        if (failed)
+            printf ("blabla_prng_jump: wrong result\n");
+
+        /* Rejections have probability range / 2^64, none happen here */
+        blabla_prng_init (&rng, key, 7);
+        blabla_prng_fill_bounded (&rng, words, 1000, 1000003);
+        for (pos = 0; pos < 1000; ++pos)
+        {
+            if (words[pos] != (uint64_t)(((u128)expected[pos] * 1000003) >> 64)
+                || blabla_prng_bounded (&rng, 1) != 0)
+                failed = 1;
+        }
+        /* Half of the words are rejected for range 2^63 + 1 */
+        for (pos = 0; pos < 1000; ++pos)
+        {
+            if (blabla_prng_bounded (&rng, (1ULL << 63) + 1) > 1ULL << 63)
+                failed = 1;
+        }
+        if (failed)
+            printf ("blabla_prng_bounded: wrong result\n");
+
+        blabla_prng_init (&rng, key, 8);
+        if (blabla_prng_u64 (&rng) == expected[0])
+        {
+            printf ("blabla_prng: same output for different streams\n");
+            failed = 1;
+        }
+
+        if (!failed)
+            printf ("blabla_prng: looks good!\n");
+        failures += failed;
+
+        free (expected);
+        free (words);
+        free (doubles);
+    }
+
+    /* blabla_rng_bytes: draws of every size are uniform-looking, never
+     * repeat, and a forked child does not replay the parent's output */
+    {
+        static const uint64_t draws[] = { 1, 7, 32, 100, 128, 4000, 20000, 3 };
+        uint8_t *buf = malloc (RNG_LEN);
+        uint64_t counts[256] = { 0 };
+        uint8_t parent[32], child[32];
+        uint64_t pos, n;
+        int failed = 0;
+        int fds[2];
+        pid_t pid;
+
+        for (pos = 0, i = 0; pos < RNG_LEN; pos += n, ++i)
+        {
+            n = draws[i % (sizeof (draws) / sizeof (draws[0]))];
+            if (n > RNG_LEN - pos)
+                n = RNG_LEN - pos;
+            if (blabla_rng_bytes (buf + pos, n) != 0)
+                failed = 1;
+        }
+        for (pos = 0; pos < RNG_LEN; ++pos)
+            ++counts[buf[pos]];
+        for (i = 0; i < 256; ++i)
+        {
+            /* more than 10 standard deviations away */
+            if (counts[i] < RNG_LEN / 256 - 640 || counts[i] > RNG_LEN / 256 + 640)
+                failed = 1;
+        }
+        for (pos = 4096; pos < RNG_LEN; pos += 4096)
+        {
+            if (memcmp (buf, buf + pos, 32) == 0)
+                failed = 1;
+        }
+        if (failed)
+            printf ("blabla_rng_bytes: output does not look random\n");
+
+        if (pipe (fds) != 0 || (pid = fork ()) < 0)
+        {
+            printf ("blabla_rng_bytes: cannot fork\n");
+            failed = 1;
+        }
+        else if (pid == 0)
+        {
+            blabla_rng_bytes (child, 32);
+            _exit (write (fds[1], child, 32) != 32);
+        }
+        else
+        {
+            blabla_rng_bytes (parent, 32);
+            if (read (fds[0], child, 32) != 32 || waitpid (pid, NULL, 0) != pid)
+            {
+                printf ("blabla_rng_bytes: child failed\n");
+                failed = 1;
+            }
+            else if (memcmp (parent, child, 32) == 0)
+            {
+                printf ("blabla_rng_bytes: same output after fork\n");
+                failed = 1;
+            }
+            close (fds[0]);
+            close (fds[1]);
+        }
+
+        if (blabla_rng_reseed () != 0)
+            failed = 1;
+        if (!failed)
+            printf ("blabla_rng_bytes: looks good!\n");
+        failures += failed;
+
+        free (buf);
+    }
+
+    return failures != 0;
 }
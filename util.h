@@ -0,0 +1,42 @@
+/*
+ * Optimized implementation of BlaBla for SSE2/SSSE3/AVX2.
+ *
+ * Copyright (C) 2017 Nagravision S.A.
+*/
+
+/*
+ * Small helpers shared by the implementation files, not part of the API.
+ */
+
+#ifndef BLABLA_UTIL_H
+#define BLABLA_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Zeroes secrets: the barrier makes the memory look read afterwards, so that
+ * the memset is not removed as a dead store before p goes out of scope */
+static inline void blabla_wipe (void *p, size_t len)
+{
+    memset (p, 0, len);
+    __asm__ __volatile__ ("" : : "r"(p) : "memory");
+}
+
+/* out = in ^ ks, 8 bytes at a time, for keystream kept in a buffer */
+static inline void blabla_xor_bytes (uint8_t *out, const uint8_t *in, const uint8_t *ks, uint64_t len)
+{
+    uint64_t i, a, b;
+
+    for (i = 0; i + 8 <= len; i += 8)
+    {
+        memcpy (&a, in + i, 8);
+        memcpy (&b, ks + i, 8);
+        a ^= b;
+        memcpy (out + i, &a, 8);
+    }
+    for (; i < len; ++i)
+        out[i] = in[i] ^ ks[i];
+}
+
+#endif